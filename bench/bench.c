@@ -0,0 +1,254 @@
+// benchmark harness: runs the `bench` word of each workload file and reports
+// timings as json, optionally compared against a previously saved run
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/forth.h"
+
+typedef struct {
+    char name[64];
+    const char *file;
+    size_t runs;
+    uint64_t median_ns;
+    uint64_t min_ns;
+    double mean_ns;
+    double stddev_ns;
+    int64_t baseline_ns;
+} bench_result_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+// forth/bench/fib.4th -> fib
+static void bench_name(const char *file, char *out, size_t size) {
+    const char *base = strrchr(file, '/');
+    base = base ? base + 1 : file;
+
+    size_t len = strcspn(base, ".");
+    if (len >= size) {
+        len = size - 1;
+    }
+    memcpy(out, base, len);
+    out[len] = '\0';
+}
+
+static void run_bench(bench_result_t *result, size_t warmup, size_t runs) {
+    forth_t forth =
+        forth_init(sizeof(forth_type_t) * 4096, sizeof(forth_type_t) * 4096);
+    forth_import_file(&forth, result->file);
+
+    for (size_t n = 0; n < warmup; n++) {
+        forth_eval(&forth, "bench");
+    }
+
+    uint64_t *samples = malloc(sizeof(uint64_t) * runs);
+    for (size_t n = 0; n < runs; n++) {
+        uint64_t start = now_ns();
+        forth_eval(&forth, "bench");
+        samples[n] = now_ns() - start;
+    }
+    fflush(stdout);
+
+    qsort(samples, runs, sizeof(uint64_t), compare_u64);
+
+    double sum = 0.0;
+    for (size_t n = 0; n < runs; n++) {
+        sum += (double) samples[n];
+    }
+    double mean = sum / (double) runs;
+
+    double var = 0.0;
+    for (size_t n = 0; n < runs; n++) {
+        double d = (double) samples[n] - mean;
+        var += d * d;
+    }
+
+    result->runs = runs;
+    result->min_ns = samples[0];
+    result->median_ns = (runs % 2) ? samples[runs / 2]
+                                   : (samples[runs / 2 - 1] +
+                                      samples[runs / 2]) / 2;
+    result->mean_ns = mean;
+    result->stddev_ns = runs > 1 ? sqrt(var / (double) (runs - 1)) : 0.0;
+
+    free(samples);
+    forth_destroy(&forth);
+}
+
+static char *read_file(const char *filename) {
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    size_t len = ftell(fp);
+    rewind(fp);
+
+    char *buffer = malloc(len + 1);
+    len = fread(buffer, 1, len, fp);
+    buffer[len] = '\0';
+    fclose(fp);
+
+    return buffer;
+}
+
+// finds "median_ns" of the named benchmark in a file written by this harness
+static int64_t baseline_median(const char *json, const char *name) {
+    char key[96];
+    snprintf(key, sizeof(key), "\"name\": \"%s\"", name);
+
+    const char *entry = strstr(json, key);
+    if (entry == NULL) {
+        return -1;
+    }
+
+    const char *end = strchr(entry, '}');
+    const char *median = strstr(entry, "\"median_ns\":");
+    if (median == NULL || (end != NULL && median > end)) {
+        return -1;
+    }
+
+    return strtoll(median + strlen("\"median_ns\":"), NULL, 10);
+}
+
+static void write_json(FILE *fp, bench_result_t *results, size_t count,
+                       size_t warmup) {
+    fprintf(fp, "{\n  \"benchmarks\": [\n");
+    for (size_t n = 0; n < count; n++) {
+        bench_result_t *r = &results[n];
+        fprintf(fp,
+                "    {\"name\": \"%s\", \"file\": \"%s\", \"warmup\": %zu, "
+                "\"runs\": %zu, \"median_ns\": %llu, \"min_ns\": %llu, "
+                "\"mean_ns\": %.1f, \"stddev_ns\": %.1f",
+                r->name, r->file, warmup, r->runs,
+                (unsigned long long) r->median_ns,
+                (unsigned long long) r->min_ns, r->mean_ns, r->stddev_ns);
+        if (r->baseline_ns > 0) {
+            fprintf(fp, ", \"baseline_median_ns\": %lld, \"change\": %.4f",
+                    (long long) r->baseline_ns,
+                    (double) r->median_ns / (double) r->baseline_ns - 1.0);
+        }
+        fprintf(fp, "}%s\n", n + 1 < count ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-w warmup] [-r runs] [-o out.json] [-b baseline.json] "
+            "[-t threshold%%] file.4th...\n",
+            argv0);
+}
+
+int main(int argc, char *argv[]) {
+    size_t warmup = 2;
+    size_t runs = 10;
+    const char *out_file = NULL;
+    const char *baseline_file = NULL;
+    double threshold = -1.0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:r:o:b:t:h")) != -1) {
+        switch (opt) {
+        case 'w':
+            warmup = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            runs = strtoul(optarg, NULL, 10);
+            break;
+        case 'o':
+            out_file = optarg;
+            break;
+        case 'b':
+            baseline_file = optarg;
+            break;
+        case 't':
+            threshold = strtod(optarg, NULL);
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (optind >= argc || runs == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    char *baseline = NULL;
+    if (baseline_file != NULL) {
+        baseline = read_file(baseline_file);
+        if (baseline == NULL) {
+            fprintf(stderr, "Error opening '%s'\n", baseline_file);
+            return 2;
+        }
+    }
+
+    // workloads print, keep that out of the report
+    int report_fd = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+
+    size_t count = (size_t) (argc - optind);
+    bench_result_t *results = calloc(count, sizeof(bench_result_t));
+    int regressed = 0;
+
+    for (size_t n = 0; n < count; n++) {
+        bench_result_t *r = &results[n];
+        r->file = argv[optind + n];
+        bench_name(r->file, r->name, sizeof(r->name));
+        r->baseline_ns = -1;
+
+        run_bench(r, warmup, runs);
+
+        fprintf(stderr, "%-12s median %10.3f ms  min %10.3f ms  sd %8.3f ms",
+                r->name, r->median_ns / 1e6, r->min_ns / 1e6,
+                r->stddev_ns / 1e6);
+
+        if (baseline != NULL) {
+            r->baseline_ns = baseline_median(baseline, r->name);
+        }
+        if (r->baseline_ns > 0) {
+            double change =
+                100.0 * ((double) r->median_ns / (double) r->baseline_ns - 1.0);
+            fprintf(stderr, "  %+7.2f%% vs baseline", change);
+            if (threshold >= 0.0 && change > threshold) {
+                fprintf(stderr, "  REGRESSION");
+                regressed = 1;
+            }
+        }
+        fprintf(stderr, "\n");
+    }
+
+    FILE *fp = out_file ? fopen(out_file, "w") : fdopen(report_fd, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Error opening '%s'\n", out_file);
+        return 2;
+    }
+    write_json(fp, results, count, warmup);
+    fclose(fp);
+
+    free(results);
+    free(baseline);
+    return regressed;
+}
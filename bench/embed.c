@@ -0,0 +1,426 @@
+// embedding benchmark: what the c api costs a host per call, with the same
+// calls made on 1 to n threads at once to show contention. reports ns per
+// operation as json, optionally compared against a previously saved run
+
+#define _GNU_SOURCE
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/forth.h"
+
+// trie_search isn't part of the api, the benchmark gets its own copy
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#include "../src/trie.h"
+#pragma GCC diagnostic pop
+
+// ffi calls are made from a forth loop this long, the loop is part of the
+// time measured for each
+#define EMBED_FFI_LOOP 1000
+
+#define EMBED_MAX_SIZES 16
+
+// one thread's instance, set up before the clock starts
+typedef struct {
+    forth_t forth;
+    char hit[32]; // a name trie_search finds
+} embed_state_t;
+
+typedef struct {
+    const char *name;
+    size_t ops; // per thread and run
+    int sized;  // runs once for every dictionary size
+    void (*run)(embed_state_t *state, size_t ops);
+} embed_case_t;
+
+typedef struct {
+    char name[64];
+    size_t threads;
+    size_t runs;
+    double median_ns; // per operation on the slowest thread of a run
+    double min_ns;
+    double baseline_ns;
+} embed_result_t;
+
+typedef struct {
+    const embed_case_t *c;
+    embed_state_t state;
+    pthread_barrier_t *start;
+    uint64_t elapsed;
+    pthread_t thread;
+} embed_worker_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// keeps the compiler from dropping a call whose result nothing reads
+static void sink(const void *p) {
+    __asm__ volatile("" : : "r"(p) : "memory");
+}
+
+static forth_t embed_init(void) {
+    return forth_init(sizeof(forth_type_t) * 4096,
+                      sizeof(forth_type_t) * 4096);
+}
+
+static void embed_nop(forth_t *forth) {
+    (void) forth;
+}
+
+static void run_init(embed_state_t *state, size_t ops) {
+    (void) state;
+    for (size_t n = 0; n < ops; n++) {
+        forth_t forth = embed_init();
+        forth_destroy(&forth);
+    }
+}
+
+static void run_eval(embed_state_t *state, size_t ops) {
+    for (size_t n = 0; n < ops; n++) {
+        forth_eval(&state->forth, "1 2 + drop");
+    }
+}
+
+static void run_define(embed_state_t *state, size_t ops) {
+    for (size_t n = 0; n < ops; n++) {
+        forth_define_word(&state->forth, "embed-word", "1 2 +");
+    }
+}
+
+static void run_ffi(embed_state_t *state, size_t ops) {
+    for (size_t n = 0; n < ops; n += EMBED_FFI_LOOP) {
+        forth_eval(&state->forth, "embed-calls");
+    }
+}
+
+static void run_variable(embed_state_t *state, size_t ops) {
+    for (size_t n = 0; n < ops; n++) {
+        sink(forth_get_variable(&state->forth, "embed-variable"));
+    }
+}
+
+// one hit and one miss make an operation
+static void run_search(embed_state_t *state, size_t ops) {
+    for (size_t n = 0; n < ops; n++) {
+        sink(trie_search(state->forth.root, state->hit));
+        sink(trie_search(state->forth.root, "embed-missing"));
+    }
+}
+
+static const embed_case_t embed_cases[] = {
+    {.name = "init_destroy", .ops = 500, .run = run_init},
+    {.name = "eval", .ops = 200000, .run = run_eval},
+    {.name = "define_word", .ops = 20000, .run = run_define},
+    {.name = "ffi_call", .ops = 1000 * EMBED_FFI_LOOP, .run = run_ffi},
+    {.name = "get_variable", .ops = 200000, .run = run_variable},
+    {.name = "trie_search", .ops = 500000, .sized = 1, .run = run_search},
+};
+
+static void embed_setup(embed_state_t *state, size_t words) {
+    state->forth = embed_init();
+    forth_t *forth = &state->forth;
+
+    char text[128];
+    forth_add_ffi_function(forth, "embed-nop", embed_nop);
+    snprintf(text, sizeof(text),
+             "variable embed-variable "
+             ": embed-calls %d 0 do embed-nop loop ;",
+             EMBED_FFI_LOOP);
+    forth_eval(forth, text);
+
+    // numbered names share prefixes the way a real vocabulary does
+    char name[32];
+    for (size_t n = 0; n < words; n++) {
+        snprintf(name, sizeof(name), "embed-%zu", n);
+        forth_define_word(forth, name, "1");
+    }
+    if (words > 0) {
+        snprintf(state->hit, sizeof(state->hit), "embed-%zu", words / 2);
+    } else {
+        snprintf(state->hit, sizeof(state->hit), "dup");
+    }
+}
+
+static void *embed_thread(void *arg) {
+    embed_worker_t *worker = arg;
+    pthread_barrier_wait(worker->start);
+    uint64_t start = now_ns();
+    worker->c->run(&worker->state, worker->c->ops);
+    worker->elapsed = now_ns() - start;
+    return NULL;
+}
+
+// ns per operation on the slowest of threads running c together
+static double embed_time(embed_worker_t *workers, size_t threads) {
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, (unsigned) threads);
+    for (size_t n = 0; n < threads; n++) {
+        workers[n].start = &start;
+        pthread_create(&workers[n].thread, NULL, embed_thread, &workers[n]);
+    }
+
+    uint64_t slowest = 0;
+    for (size_t n = 0; n < threads; n++) {
+        pthread_join(workers[n].thread, NULL);
+        if (workers[n].elapsed > slowest) {
+            slowest = workers[n].elapsed;
+        }
+    }
+    pthread_barrier_destroy(&start);
+    return (double) slowest / (double) workers[0].c->ops;
+}
+
+static void embed_run(embed_result_t *result, const embed_case_t *c,
+                      size_t words, size_t threads, size_t warmup,
+                      size_t runs) {
+    embed_worker_t *workers = calloc(threads, sizeof(embed_worker_t));
+    for (size_t n = 0; n < threads; n++) {
+        workers[n].c = c;
+        embed_setup(&workers[n].state, words);
+    }
+
+    for (size_t n = 0; n < warmup; n++) {
+        embed_time(workers, threads);
+    }
+
+    double *samples = malloc(sizeof(double) * runs);
+    for (size_t n = 0; n < runs; n++) {
+        samples[n] = embed_time(workers, threads);
+    }
+    qsort(samples, runs, sizeof(double), compare_double);
+
+    result->threads = threads;
+    result->runs = runs;
+    result->min_ns = samples[0];
+    result->median_ns = (runs % 2) ? samples[runs / 2]
+                                   : (samples[runs / 2 - 1] +
+                                      samples[runs / 2]) / 2;
+
+    free(samples);
+    for (size_t n = 0; n < threads; n++) {
+        forth_destroy(&workers[n].state.forth);
+    }
+    free(workers);
+}
+
+static char *read_file(const char *filename) {
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    size_t len = ftell(fp);
+    rewind(fp);
+
+    char *buffer = malloc(len + 1);
+    len = fread(buffer, 1, len, fp);
+    buffer[len] = '\0';
+    fclose(fp);
+
+    return buffer;
+}
+
+// finds "median_ns" of the named benchmark at the same thread count in a
+// file written by this harness
+static double baseline_median(const char *json, const embed_result_t *r) {
+    char key[128];
+    snprintf(key, sizeof(key), "\"name\": \"%s\", \"threads\": %zu", r->name,
+             r->threads);
+
+    const char *entry = strstr(json, key);
+    if (entry == NULL) {
+        return -1.0;
+    }
+
+    const char *end = strchr(entry, '}');
+    const char *median = strstr(entry, "\"median_ns\":");
+    if (median == NULL || (end != NULL && median > end)) {
+        return -1.0;
+    }
+
+    return strtod(median + strlen("\"median_ns\":"), NULL);
+}
+
+static void write_json(FILE *fp, embed_result_t *results, size_t count,
+                       size_t warmup) {
+    fprintf(fp, "{\n  \"benchmarks\": [\n");
+    for (size_t n = 0; n < count; n++) {
+        embed_result_t *r = &results[n];
+        fprintf(fp,
+                "    {\"name\": \"%s\", \"threads\": %zu, \"warmup\": %zu, "
+                "\"runs\": %zu, \"median_ns\": %.2f, \"min_ns\": %.2f",
+                r->name, r->threads, warmup, r->runs, r->median_ns,
+                r->min_ns);
+        if (r->baseline_ns > 0) {
+            fprintf(fp, ", \"baseline_median_ns\": %.2f, \"change\": %.4f",
+                    r->baseline_ns, r->median_ns / r->baseline_ns - 1.0);
+        }
+        fprintf(fp, "}%s\n", n + 1 < count ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+}
+
+// "0,1000,10000" -> sizes, returns how many
+static size_t parse_sizes(const char *text, size_t *sizes) {
+    size_t count = 0;
+    while (count < EMBED_MAX_SIZES) {
+        char *end;
+        sizes[count++] = strtoul(text, &end, 10);
+        if (*end != ',') {
+            break;
+        }
+        text = end + 1;
+    }
+    return count;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-w warmup] [-r runs] [-j max-threads] "
+            "[-d words,...] [-o out.json] [-b baseline.json] "
+            "[-t threshold%%] [case...]\n",
+            argv0);
+}
+
+int main(int argc, char *argv[]) {
+    size_t warmup = 1;
+    size_t runs = 7;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t max_threads = cpus > 0 ? (size_t) cpus : 1;
+    size_t sizes[EMBED_MAX_SIZES] = {0, 1000, 10000};
+    size_t size_count = 3;
+    const char *out_file = NULL;
+    const char *baseline_file = NULL;
+    double threshold = -1.0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:r:j:d:o:b:t:h")) != -1) {
+        switch (opt) {
+        case 'w':
+            warmup = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            runs = strtoul(optarg, NULL, 10);
+            break;
+        case 'j':
+            max_threads = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            size_count = parse_sizes(optarg, sizes);
+            break;
+        case 'o':
+            out_file = optarg;
+            break;
+        case 'b':
+            baseline_file = optarg;
+            break;
+        case 't':
+            threshold = strtod(optarg, NULL);
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (runs == 0 || max_threads == 0 || size_count == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    char *baseline = NULL;
+    if (baseline_file != NULL) {
+        baseline = read_file(baseline_file);
+        if (baseline == NULL) {
+            fprintf(stderr, "Error opening '%s'\n", baseline_file);
+            return 2;
+        }
+    }
+
+    // 1, 2, 4 ... threads and then max_threads itself
+    size_t thread_counts[64];
+    size_t thread_count = 0;
+    for (size_t t = 1; t < max_threads && thread_count < 63; t *= 2) {
+        thread_counts[thread_count++] = t;
+    }
+    thread_counts[thread_count++] = max_threads;
+
+    size_t case_count = sizeof(embed_cases) / sizeof(embed_cases[0]);
+    size_t capacity = case_count * size_count * thread_count;
+    embed_result_t *results = calloc(capacity, sizeof(embed_result_t));
+    size_t count = 0;
+    int regressed = 0;
+
+    for (size_t k = 0; k < case_count; k++) {
+        const embed_case_t *c = &embed_cases[k];
+        int wanted = optind == argc;
+        for (int a = optind; a < argc; a++) {
+            wanted |= strcmp(argv[a], c->name) == 0;
+        }
+        if (!wanted) {
+            continue;
+        }
+
+        for (size_t s = 0; s < (c->sized ? size_count : 1); s++) {
+            for (size_t t = 0; t < thread_count; t++) {
+                embed_result_t *r = &results[count++];
+                if (c->sized) {
+                    snprintf(r->name, sizeof(r->name), "%s/%zu", c->name,
+                             sizes[s]);
+                } else {
+                    snprintf(r->name, sizeof(r->name), "%s", c->name);
+                }
+                embed_run(r, c, c->sized ? sizes[s] : 0, thread_counts[t],
+                          warmup, runs);
+
+                fprintf(stderr,
+                        "%-18s %3zu threads  median %10.1f ns  min %10.1f ns",
+                        r->name, r->threads, r->median_ns, r->min_ns);
+
+                r->baseline_ns =
+                    baseline != NULL ? baseline_median(baseline, r) : -1.0;
+                if (r->baseline_ns > 0) {
+                    double change = 100.0 * (r->median_ns / r->baseline_ns -
+                                             1.0);
+                    fprintf(stderr, "  %+7.2f%% vs baseline", change);
+                    if (threshold >= 0.0 && change > threshold) {
+                        fprintf(stderr, "  REGRESSION");
+                        regressed = 1;
+                    }
+                }
+                fprintf(stderr, "\n");
+            }
+        }
+    }
+
+    FILE *fp = out_file ? fopen(out_file, "w") : stdout;
+    if (fp == NULL) {
+        fprintf(stderr, "Error opening '%s'\n", out_file);
+        return 2;
+    }
+    write_json(fp, results, count, warmup);
+    if (fp != stdout) {
+        fclose(fp);
+    }
+
+    free(results);
+    free(baseline);
+    return regressed;
+}
@@ -0,0 +1,233 @@
+// load generator for meili --serve: keeps a number of connections busy with
+// pipelined requests and reports throughput and latency percentiles as json
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    const char *path;
+    const char *text;
+    size_t requests;
+    size_t depth;
+    uint64_t *latencies;
+    size_t failed;
+    int broken;
+    pthread_t thread;
+} load_conn_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t get_u32(const unsigned char *bytes) {
+    return (uint32_t) bytes[0] << 24 | (uint32_t) bytes[1] << 16 |
+           (uint32_t) bytes[2] << 8 | bytes[3];
+}
+
+static int read_all(int fd, void *buf, size_t len) {
+    char *at = buf;
+    while (len > 0) {
+        ssize_t got = read(fd, at, len);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return 0;
+        }
+        at += got;
+        len -= (size_t) got;
+    }
+    return 1;
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *at = buf;
+    while (len > 0) {
+        ssize_t done = write(fd, at, len);
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (done <= 0) {
+            return 0;
+        }
+        at += done;
+        len -= (size_t) done;
+    }
+    return 1;
+}
+
+// reads one response and its throw code, 0 when the server is gone
+static int read_response(int fd, int32_t *code) {
+    unsigned char header[12];
+    if (!read_all(fd, header, sizeof(header))) {
+        return 0;
+    }
+    size_t len = (size_t) get_u32(header + 4) + get_u32(header + 8);
+    char skip[4096];
+    while (len > 0) {
+        size_t part = len < sizeof(skip) ? len : sizeof(skip);
+        if (!read_all(fd, skip, part)) {
+            return 0;
+        }
+        len -= part;
+    }
+    *code = (int32_t) get_u32(header);
+    return 1;
+}
+
+// keeps depth requests in flight until all of them were answered
+static void *load_thread(void *arg) {
+    load_conn_t *conn = arg;
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strncpy(addr.sun_path, conn->path, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        conn->broken = 1;
+        return NULL;
+    }
+
+    size_t len = strlen(conn->text);
+    char *frame = malloc(len + 4);
+    frame[0] = (char) (len >> 24);
+    frame[1] = (char) (len >> 16);
+    frame[2] = (char) (len >> 8);
+    frame[3] = (char) len;
+    memcpy(frame + 4, conn->text, len);
+
+    uint64_t *sent = calloc(conn->depth, sizeof(uint64_t));
+    size_t issued = 0;
+    for (size_t done = 0; done < conn->requests; done++) {
+        while (issued < conn->requests && issued < done + conn->depth) {
+            sent[issued % conn->depth] = now_ns();
+            if (!write_all(fd, frame, len + 4)) {
+                conn->broken = 1;
+                goto out;
+            }
+            issued++;
+        }
+
+        int32_t code;
+        if (!read_response(fd, &code)) {
+            conn->broken = 1;
+            goto out;
+        }
+        conn->failed += code != 0;
+        conn->latencies[done] = now_ns() - sent[done % conn->depth];
+    }
+
+out:
+    free(sent);
+    free(frame);
+    close(fd);
+    return NULL;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-c connections] [-n requests] [-d depth] "
+            "[-e text] socket\n",
+            argv0);
+}
+
+int main(int argc, char *argv[]) {
+    size_t connections = 4;
+    size_t requests = 10000;
+    size_t depth = 1;
+    const char *text = "1 2 + .";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:n:d:e:h")) != -1) {
+        switch (opt) {
+        case 'c':
+            connections = strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            requests = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            depth = strtoul(optarg, NULL, 10);
+            break;
+        case 'e':
+            text = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (optind + 1 != argc || connections == 0 || requests == 0 ||
+        depth == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    load_conn_t *conns = calloc(connections, sizeof(load_conn_t));
+    uint64_t start = now_ns();
+    for (size_t n = 0; n < connections; n++) {
+        load_conn_t *conn = &conns[n];
+        conn->path = argv[optind];
+        conn->text = text;
+        conn->requests = requests;
+        conn->depth = depth;
+        conn->latencies = calloc(requests, sizeof(uint64_t));
+        pthread_create(&conn->thread, NULL, load_thread, conn);
+    }
+
+    size_t total = 0;
+    size_t failed = 0;
+    int broken = 0;
+    uint64_t *all = malloc(sizeof(uint64_t) * connections * requests);
+    for (size_t n = 0; n < connections; n++) {
+        load_conn_t *conn = &conns[n];
+        pthread_join(conn->thread, NULL);
+        broken |= conn->broken;
+        failed += conn->failed;
+        for (size_t r = 0; r < requests && conn->latencies[r] != 0; r++) {
+            all[total++] = conn->latencies[r];
+        }
+        free(conn->latencies);
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    if (broken || total == 0) {
+        fprintf(stderr, "Error: lost the connection to '%s'\n", argv[optind]);
+        return 1;
+    }
+
+    qsort(all, total, sizeof(uint64_t), compare_u64);
+    double per_sec = (double) total / ((double) elapsed / 1e9);
+    uint64_t p50 = all[total / 2];
+    uint64_t p99 = all[(total * 99) / 100];
+
+    fprintf(stderr, "%zu requests  %.0f req/s  p50 %.1f us  p99 %.1f us\n",
+            total, per_sec, p50 / 1e3, p99 / 1e3);
+    printf("{\"connections\": %zu, \"depth\": %zu, \"requests\": %zu, "
+           "\"failed\": %zu, \"requests_per_sec\": %.1f, \"p50_ns\": %llu, "
+           "\"p99_ns\": %llu, \"max_ns\": %llu}\n",
+           connections, depth, total, failed, per_sec,
+           (unsigned long long) p50, (unsigned long long) p99,
+           (unsigned long long) all[total - 1]);
+
+    free(all);
+    free(conns);
+    return 0;
+}
@@ -0,0 +1,363 @@
+#pragma once
+
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "forth.h"
+#include "task.h"
+
+// threads doing reads and writes when io_uring isn't available
+#define AIO_THREADS 4
+
+typedef struct {
+    int used; // handed out and not awaited yet
+    atomic_int done;
+    int64_t result; // bytes transferred or a negated errno
+
+    int fd;
+    int write;
+    void *buf;
+    size_t len;
+    uint64_t offset;
+} forth_aio_req_t;
+
+typedef struct forth_aio_s {
+    forth_aio_req_t reqs[FORTH_AIO_DEPTH];
+    size_t in_flight;
+
+    // io_uring, ring_fd is -1 when the thread pool is used instead
+    int ring_fd;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    // thread pool, queue holds request indices
+    pthread_t threads[AIO_THREADS];
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t finished;
+    size_t queue[FORTH_AIO_DEPTH];
+    size_t queue_head;
+    size_t queue_length;
+    int quit;
+} forth_aio_t;
+
+// what await runs when typed outside a definition
+static const struct forth_instr_s aio_await_code[] = {{.op = OP_AWAIT},
+                                                     {.op = OP_EXIT}};
+
+static int aio_uring_init(forth_aio_t *aio) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = (int) syscall(__NR_io_uring_setup, FORTH_AIO_DEPTH, &params);
+    if (fd < 0) {
+        return 0;
+    }
+
+    aio->sq_ring_size =
+        params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    aio->cq_ring_size =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (aio->cq_ring_size > aio->sq_ring_size) {
+            aio->sq_ring_size = aio->cq_ring_size;
+        }
+        aio->cq_ring_size = 0;
+    }
+
+    aio->sq_ring = mmap(NULL, aio->sq_ring_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (aio->sq_ring == MAP_FAILED) {
+        close(fd);
+        return 0;
+    }
+
+    aio->cq_ring = aio->sq_ring;
+    if (aio->cq_ring_size > 0) {
+        aio->cq_ring = mmap(NULL, aio->cq_ring_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (aio->cq_ring == MAP_FAILED) {
+            munmap(aio->sq_ring, aio->sq_ring_size);
+            close(fd);
+            return 0;
+        }
+    }
+
+    aio->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    aio->sqes = mmap(NULL, aio->sqes_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (aio->sqes == MAP_FAILED) {
+        munmap(aio->sq_ring, aio->sq_ring_size);
+        if (aio->cq_ring_size > 0) {
+            munmap(aio->cq_ring, aio->cq_ring_size);
+        }
+        close(fd);
+        return 0;
+    }
+
+    uint8_t *sq = aio->sq_ring;
+    uint8_t *cq = aio->cq_ring;
+    aio->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    aio->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    aio->sq_array = (unsigned *) (sq + params.sq_off.array);
+    aio->cq_head = (unsigned *) (cq + params.cq_off.head);
+    aio->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    aio->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    aio->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    aio->ring_fd = fd;
+    return 1;
+}
+
+static void aio_complete(forth_aio_req_t *req, int64_t result) {
+    req->result = result;
+    atomic_store_explicit(&req->done, 1, memory_order_release);
+}
+
+static void *aio_thread(void *arg) {
+    forth_aio_t *aio = arg;
+
+    pthread_mutex_lock(&aio->lock);
+    for (;;) {
+        while (aio->queue_length == 0 && !aio->quit) {
+            pthread_cond_wait(&aio->work, &aio->lock);
+        }
+        if (aio->queue_length == 0) {
+            break;
+        }
+        forth_aio_req_t *req = &aio->reqs[aio->queue[aio->queue_head]];
+        aio->queue_head = (aio->queue_head + 1) % FORTH_AIO_DEPTH;
+        aio->queue_length--;
+        pthread_mutex_unlock(&aio->lock);
+
+        ssize_t n = req->write
+                        ? pwrite(req->fd, req->buf, req->len, req->offset)
+                        : pread(req->fd, req->buf, req->len, req->offset);
+        aio_complete(req, n < 0 ? -errno : n);
+
+        pthread_mutex_lock(&aio->lock);
+        pthread_cond_broadcast(&aio->finished);
+    }
+    pthread_mutex_unlock(&aio->lock);
+
+    return NULL;
+}
+
+static forth_aio_t *aio_create(void) {
+    forth_aio_t *aio = calloc(1, sizeof(forth_aio_t));
+    aio->ring_fd = -1;
+
+    if (FORTH_AIO_URING && aio_uring_init(aio)) {
+        return aio;
+    }
+
+    pthread_mutex_init(&aio->lock, NULL);
+    pthread_cond_init(&aio->work, NULL);
+    pthread_cond_init(&aio->finished, NULL);
+    for (size_t n = 0; n < AIO_THREADS; n++) {
+        pthread_create(&aio->threads[n], NULL, aio_thread, aio);
+    }
+    return aio;
+}
+
+static int aio_is_done(forth_aio_req_t *req) {
+    return atomic_load_explicit(&req->done, memory_order_acquire);
+}
+
+// collects finished requests, and waits until wait is done unless it is
+// NULL
+static void aio_reap(forth_aio_t *aio, forth_aio_req_t *wait) {
+    if (aio->ring_fd < 0) {
+        // threads set done before they take the lock to broadcast, so
+        // checking it under the lock can't miss the wakeup
+        if (wait != NULL) {
+            pthread_mutex_lock(&aio->lock);
+            while (!aio_is_done(wait)) {
+                pthread_cond_wait(&aio->finished, &aio->lock);
+            }
+            pthread_mutex_unlock(&aio->lock);
+        }
+        return;
+    }
+
+    for (;;) {
+        unsigned head = *aio->cq_head;
+        unsigned tail = __atomic_load_n(aio->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe *cqe = &aio->cqes[head & *aio->cq_mask];
+            aio_complete(&aio->reqs[cqe->user_data], cqe->res);
+            head++;
+        }
+        __atomic_store_n(aio->cq_head, head, __ATOMIC_RELEASE);
+
+        if (wait == NULL || aio_is_done(wait)) {
+            return;
+        }
+        syscall(__NR_io_uring_enter, aio->ring_fd, 0, 1,
+                IORING_ENTER_GETEVENTS, NULL, 0);
+    }
+}
+
+// returns the request's id, 0 when too many are outstanding
+static int64_t aio_submit(forth_aio_t *aio, int fd, int write, void *buf,
+                          size_t len, uint64_t offset) {
+    size_t idx = 0;
+    while (idx < FORTH_AIO_DEPTH && aio->reqs[idx].used) {
+        idx++;
+    }
+    if (idx == FORTH_AIO_DEPTH) {
+        return 0;
+    }
+
+    forth_aio_req_t *req = &aio->reqs[idx];
+    *req = (forth_aio_req_t) {
+        .used = 1,
+        .fd = fd,
+        .write = write,
+        .buf = buf,
+        .len = len,
+        .offset = offset,
+    };
+    aio->in_flight++;
+
+    if (aio->ring_fd < 0) {
+        pthread_mutex_lock(&aio->lock);
+        size_t slot = (aio->queue_head + aio->queue_length) % FORTH_AIO_DEPTH;
+        aio->queue[slot] = idx;
+        aio->queue_length++;
+        pthread_cond_signal(&aio->work);
+        pthread_mutex_unlock(&aio->lock);
+        return (int64_t) idx + 1;
+    }
+
+    // the ring has room for every request, so the tail never catches up
+    unsigned tail = *aio->sq_tail;
+    unsigned slot = tail & *aio->sq_mask;
+    struct io_uring_sqe *sqe = &aio->sqes[slot];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) buf;
+    sqe->len = (uint32_t) len; // file_submit keeps it under 4 GiB
+    sqe->off = offset;
+    sqe->user_data = idx;
+    aio->sq_array[slot] = slot;
+    __atomic_store_n(aio->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    if (syscall(__NR_io_uring_enter, aio->ring_fd, 1, 0, 0, NULL, 0) < 0) {
+        aio_complete(req, -errno);
+    }
+    return (int64_t) idx + 1;
+}
+
+static void aio_destroy(forth_aio_t *aio) {
+    if (aio == NULL) {
+        return;
+    }
+
+    // the kernel or a thread may still be writing into the heap
+    for (size_t n = 0; n < FORTH_AIO_DEPTH; n++) {
+        if (aio->reqs[n].used) {
+            aio_reap(aio, &aio->reqs[n]);
+        }
+    }
+
+    if (aio->ring_fd >= 0) {
+        munmap(aio->sqes, aio->sqes_size);
+        if (aio->cq_ring_size > 0) {
+            munmap(aio->cq_ring, aio->cq_ring_size);
+        }
+        munmap(aio->sq_ring, aio->sq_ring_size);
+        close(aio->ring_fd);
+    } else {
+        pthread_mutex_lock(&aio->lock);
+        aio->quit = 1;
+        pthread_cond_broadcast(&aio->work);
+        pthread_mutex_unlock(&aio->lock);
+        for (size_t n = 0; n < AIO_THREADS; n++) {
+            pthread_join(aio->threads[n], NULL);
+        }
+        pthread_mutex_destroy(&aio->lock);
+        pthread_cond_destroy(&aio->work);
+        pthread_cond_destroy(&aio->finished);
+    }
+    free(aio);
+}
+
+// a task other than the running one that can get somewhere, -1 if every
+// other task is stuck in await too
+static int64_t aio_runnable(forth_t *forth) {
+    for (int64_t n = 1; n < forth->task_count; n++) {
+        int64_t id = (forth->task + n) % forth->task_count;
+        forth_task_t *task = &forth->tasks[id];
+        if (task->state != TASK_READY) {
+            continue;
+        }
+        if (task->awaiting == 0 ||
+            aio_is_done(&forth->aio->reqs[task->awaiting - 1])) {
+            return id;
+        }
+    }
+    return -1;
+}
+
+// await ( req -- n ior ), switches to other tasks while the request is in
+// flight and only blocks when none of them can run
+static const struct forth_instr_s *
+aio_await(forth_t *forth, const struct forth_instr_s *ip, int nested) {
+    forth_stack_t *data = &forth->data_stack;
+    forth_aio_t *aio = forth->aio;
+    int64_t id = stack_pop(data).int64;
+
+    if (aio == NULL || id <= 0 || id > FORTH_AIO_DEPTH ||
+        !aio->reqs[id - 1].used) {
+        forth_throw(forth, FORTH_THROW_INVALID_ARGUMENT,
+                    "no request %" PRId64 " to await", id);
+        return ip + 1;
+    }
+
+    forth_aio_req_t *req = &aio->reqs[id - 1];
+    for (;;) {
+        aio_reap(aio, NULL);
+        if (aio_is_done(req)) {
+            break;
+        }
+
+        int64_t next = !nested && forth->tasks ? aio_runnable(forth) : -1;
+        if (next >= 0) {
+            stack_push(data, forth_i64(id));
+            forth->tasks[forth->task].awaiting = id;
+            return task_switch_to(forth, ip, next);
+        }
+        aio_reap(aio, req);
+    }
+
+    if (forth->tasks != NULL) {
+        forth->tasks[forth->task].awaiting = 0;
+    }
+    req->used = 0;
+    aio->in_flight--;
+    stack_push(data, forth_i64(req->result < 0 ? 0 : req->result));
+    stack_push(data, forth_i64(req->result < 0 ? req->result : 0));
+    return ip + 1;
+}
@@ -1,38 +1,261 @@
 #pragma once
 
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <math.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "aio.h"
+#include "format.h"
 #include "forth.h"
+#include "par.h"
+#include "random.h"
+#include "task.h"
 #include "trie.h"
 
 #ifndef M_PI
 #define M_PI 3.1415926535897932384626433832
 #endif
 
-#define BUILTIN(name)                                                          \
-    static void forth_builtin_##name(forth_t *forth, size_t *i, char **words,  \
-                                     size_t words_length)
+#define BUILTIN(name) static void forth_builtin_##name(forth_t *forth)
 
 #define REGISTER(name, fn_name)                                                \
-    trie_insert_builtin(forth->root, name, forth_builtin_##fn_name)
+    trie_insert_builtin(forth, name, forth_builtin_##fn_name)
+
+// executed while compiling instead of being compiled
+#define REGISTER_IMMEDIATE(name, fn_name)                                      \
+    REGISTER(name, fn_name)->flags = FORTH_WORD_IMMEDIATE
+
+// only meaningful inside a definition
+#define REGISTER_COMPILE_ONLY(name, fn_name)                                   \
+    REGISTER(name, fn_name)->flags =                                           \
+        FORTH_WORD_IMMEDIATE | FORTH_WORD_COMPILE_ONLY
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-parameter"
 
+// reads the name following a defining or parsing word
+static int parse_name(forth_t *forth, char *buf, size_t size,
+                      const char *word) {
+    if (forth_parse_name(forth, buf, size) == 0) {
+        forth_throw(forth, FORTH_THROW_NO_NAME, "'%s' expects a name", word);
+        forth_abort_compile(forth);
+        return 0;
+    }
+    return 1;
+}
+
+// the dictionary only holds ascii names
+static int valid_name(forth_t *forth, const char *name) {
+    for (const char *c = name; *c != '\0'; c++) {
+        if ((unsigned char) *c >= ALPHABET_SIZE) {
+            forth_throw(forth, FORTH_THROW_INVALID_NAME, "invalid name '%s'",
+                        name);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// the host address of the len bytes at addr, NULL after a throw when addr
+// isn't a reference or the bytes aren't all in the segment it points into.
+// what says what was being done, as in "loading from"
+static void *ref_bytes(forth_t *forth, forth_type_t addr, int64_t len,
+                       const char *what) {
+    if (addr.tag != FORTH_REF) {
+        forth_throw(forth, FORTH_THROW_INVALID_ADDRESS,
+                    "%s non-reference type", what);
+        return NULL;
+    }
+    void *host = len >= 0 ? forth_addr(forth, addr.ref, (size_t) len) : NULL;
+    if (host == NULL) {
+        forth_throw(forth, FORTH_THROW_INVALID_ADDRESS, "%s invalid address",
+                    what);
+    }
+    return host;
+}
+
+// the offset of len more bytes at the end of the heap, which then starts
+// on a cell again. SIZE_MAX after a throw when they don't fit
+static size_t heap_reserve(forth_t *forth, size_t len, const char *what) {
+    size_t alignment = sizeof(forth_type_t);
+    size_t offset = forth->next_address;
+    // the heap is whole cells, so rounding up never passes its end
+    if (len > forth->heap_size - offset) {
+        forth_throw(forth, FORTH_THROW_HEAP_FULL, "%s: heap full", what);
+        return SIZE_MAX;
+    }
+    forth->next_address = (offset + len + alignment - 1) & ~(alignment - 1);
+    return offset;
+}
+
+// control structure markers left on the control stack while compiling, each
+// is an instruction index followed by its kind
+enum CONTROL_KIND {
+    CONTROL_ORIG,
+    CONTROL_DEST,
+    CONTROL_DO,
+    CONTROL_PAR,
+};
+
+static inline void compile_op(forth_t *forth, enum FORTH_OPCODE op,
+                              int64_t offset) {
+    forth_compile(forth, (forth_instr_t) {.op = op, .offset = offset});
+}
+
+static void control_push(forth_t *forth, enum CONTROL_KIND kind, size_t idx) {
+    stack_push(&forth->control_stack, forth_ref(idx));
+    stack_push(&forth->control_stack, forth_i64(kind));
+}
+
+static int control_pop(forth_t *forth, enum CONTROL_KIND kind, size_t *idx) {
+    forth_stack_t *control = &forth->control_stack;
+
+    if (control->top - 2 < forth->compile_base ||
+        control->data[control->top - 1].int64 != kind) {
+        forth_throw(forth, FORTH_THROW_CONTROL_MISMATCH,
+                    "unbalanced control structure");
+        forth_abort_compile(forth);
+        return 0;
+    }
+
+    *idx = control->data[control->top - 2].ref;
+    control->top -= 2;
+    return 1;
+}
+
+// points the branch at idx to the next instruction
+static void control_resolve(forth_t *forth, size_t idx) {
+    forth->code[idx].offset = (int64_t) (forth->code_length - idx);
+}
+
 // : ... ;
 BUILTIN(colon) {
-    char *new_word = words[++(*i)];
-    char def[MAX_WORD_DEFINITION_SIZE];
-    size_t idx = 0;
+    char name[MAX_WORD_LENGTH];
+    if (parse_name(forth, name, sizeof(name), ":") &&
+        valid_name(forth, name)) {
+        forth_begin_definition(forth, name);
+    }
+}
+
+// ;
+BUILTIN(semicolon) {
+    forth_end_definition(forth);
+}
+
+// recurse
+BUILTIN(recurse) {
+    if (!forth->defining || forth->latest == NULL) {
+        forth_throw(forth, FORTH_THROW_COMPILE_ONLY,
+                    "'recurse' outside a definition");
+        forth_abort_compile(forth);
+        return;
+    }
+    forth_compile(forth,
+                  (forth_instr_t) {.op = OP_CALL, .node = forth->latest});
+}
+
+// exit
+BUILTIN(exit) {
+    compile_op(forth, OP_EXIT, 0);
+}
+
+// immediate
+BUILTIN(immediate) {
+    if (forth->defining || forth->latest == NULL) {
+        forth_throw(forth, FORTH_THROW_UNSUPPORTED,
+                    "'immediate' without a definition");
+        return;
+    }
+    forth->latest->flags |= FORTH_WORD_IMMEDIATE;
+}
+
+// [
+BUILTIN(lbracket) {
+    forth->state->int64 = 0;
+}
+
+// ]
+BUILTIN(rbracket) {
+    if (!forth->defining) {
+        forth_throw(forth, FORTH_THROW_COMPILE_ONLY,
+                    "']' outside a definition");
+        return;
+    }
+    forth->state->int64 = -1;
+}
+
+// literal
+BUILTIN(literal) {
+    forth_type_t val = stack_pop(&forth->data_stack);
+    forth_compile(forth, (forth_instr_t) {.op = OP_LITERAL, .literal = val});
+}
+
+// constant
+BUILTIN(constant) {
+    char name[MAX_WORD_LENGTH];
+    if (!parse_name(forth, name, sizeof(name), "constant") ||
+        !valid_name(forth, name)) {
+        return;
+    }
+
+    // compiled as a literal, so using a constant costs nothing at runtime
+    forth_type_t val = stack_pop(&forth->data_stack);
+    trie_node_t *node = trie_insert_variable(forth, name, val);
+    if (!forth->defining) {
+        forth->latest = node;
+    }
+}
+
+// value
+BUILTIN(value) {
+    char name[MAX_WORD_LENGTH];
+    if (!parse_name(forth, name, sizeof(name), "value") ||
+        !valid_name(forth, name)) {
+        return;
+    }
 
-    while (strcmp(words[++(*i)], ";") != 0) {
-        idx += sprintf(&def[idx], "%s ", words[*i]);
+    // the cell is always on the heap, so its reference is its offset
+    size_t offset = heap_reserve(forth, sizeof(forth_type_t), "value");
+    if (offset == SIZE_MAX) {
+        return;
+    }
+    *(forth_type_t *) (forth->heap + offset) = stack_pop(&forth->data_stack);
+
+    trie_node_t *node =
+        trie_insert_value(forth, name, forth_ref(offset));
+    if (!forth->defining) {
+        forth->latest = node;
     }
+}
 
-    trie_insert_userword(forth->root, new_word, def);
+// to
+BUILTIN(to) {
+    char name[MAX_WORD_LENGTH];
+    if (!parse_name(forth, name, sizeof(name), "to")) {
+        return;
+    }
+
+    trie_node_t *node = trie_search(forth->root, name);
+    if (node == NULL || node->node_type != TRIE_VALUE) {
+        forth_throw(forth, FORTH_THROW_INVALID_NAME, "'%s' is not a value",
+                    name);
+        forth_abort_compile(forth);
+        return;
+    }
+
+    if (forth->state->int64) {
+        forth_compile(forth,
+                      (forth_instr_t) {.op = OP_STORE, .literal = node->var});
+    } else {
+        *(forth_type_t *) (forth->heap + node->var.ref) =
+            stack_pop(&forth->data_stack);
+    }
 }
 
 // dup
@@ -76,13 +299,17 @@ BUILTIN(rot) {
 // pick
 BUILTIN(pick) {
     int64_t idx = stack_pop(&forth->data_stack).int64;
-    forth_type_t nth = stack_peek_idx(&forth->data_stack, idx);
+    forth_type_t nth = stack_peek_idx(&forth->data_stack, idx + 1);
     stack_push(&forth->data_stack, nth);
 }
 
 // roll
 BUILTIN(roll) {
     int64_t n = stack_pop(&forth->data_stack).int64;
+    if (n < 0 || n >= forth->data_stack.top) {
+        forth->data_stack.fault = FORTH_THROW_STACK_UNDERFLOW;
+        return;
+    }
 
     size_t top = forth->data_stack.top;
     size_t src_idx = top - 1 - n;
@@ -104,6 +331,50 @@ BUILTIN(cmp_dup) {
     }
 }
 
+// 2dup
+BUILTIN(two_dup) {
+    forth_stack_t *data = &forth->data_stack;
+    if (data->top < 2) {
+        data->fault = FORTH_THROW_STACK_UNDERFLOW;
+        return;
+    }
+    forth_type_t second = data->data[data->top - 2];
+    forth_type_t top = data->data[data->top - 1];
+    stack_push(data, second);
+    stack_push(data, top);
+}
+
+// 2drop
+BUILTIN(two_drop) {
+    stack_pop(&forth->data_stack);
+    stack_pop(&forth->data_stack);
+}
+
+// 2swap
+BUILTIN(two_swap) {
+    forth_type_t n4 = stack_pop(&forth->data_stack);
+    forth_type_t n3 = stack_pop(&forth->data_stack);
+    forth_type_t n2 = stack_pop(&forth->data_stack);
+    forth_type_t n1 = stack_pop(&forth->data_stack);
+    stack_push(&forth->data_stack, n3);
+    stack_push(&forth->data_stack, n4);
+    stack_push(&forth->data_stack, n1);
+    stack_push(&forth->data_stack, n2);
+}
+
+// 2over
+BUILTIN(two_over) {
+    forth_stack_t *data = &forth->data_stack;
+    if (data->top < 4) {
+        data->fault = FORTH_THROW_STACK_UNDERFLOW;
+        return;
+    }
+    forth_type_t n1 = data->data[data->top - 4];
+    forth_type_t n2 = data->data[data->top - 3];
+    stack_push(data, n1);
+    stack_push(data, n2);
+}
+
 // depth
 BUILTIN(depth) {
     forth_type_t depth = forth_i64(forth->data_stack.top);
@@ -223,26 +494,45 @@ BUILTIN(mul) {
     stack_push(&forth->data_stack, forth_i64(a.int64 * b.int64));
 }
 
+// both trap in hardware instead of giving a result
+static int divisor_ok(forth_t *forth, int64_t a, int64_t b) {
+    if (b == 0) {
+        forth_throw(forth, FORTH_THROW_DIVISION_BY_ZERO, "division by zero");
+        return 0;
+    }
+    if (a == INT64_MIN && b == -1) {
+        forth_throw(forth, FORTH_THROW_OUT_OF_RANGE, "division overflow");
+        return 0;
+    }
+    return 1;
+}
+
 // /
 BUILTIN(div) {
     forth_type_t b = stack_pop(&forth->data_stack);
     forth_type_t a = stack_pop(&forth->data_stack);
-    stack_push(&forth->data_stack, forth_i64(a.int64 / b.int64));
+    if (divisor_ok(forth, a.int64, b.int64)) {
+        stack_push(&forth->data_stack, forth_i64(a.int64 / b.int64));
+    }
 }
 
 // mod
 BUILTIN(mod) {
     forth_type_t b = stack_pop(&forth->data_stack);
     forth_type_t a = stack_pop(&forth->data_stack);
-    stack_push(&forth->data_stack, forth_i64(a.int64 % b.int64));
+    if (divisor_ok(forth, a.int64, b.int64)) {
+        stack_push(&forth->data_stack, forth_i64(a.int64 % b.int64));
+    }
 }
 
 // /mod
 BUILTIN(divmod) {
     forth_type_t b = stack_pop(&forth->data_stack);
     forth_type_t a = stack_pop(&forth->data_stack);
-    stack_push(&forth->data_stack, forth_i64(a.int64 % b.int64));
-    stack_push(&forth->data_stack, forth_i64(a.int64 / b.int64));
+    if (divisor_ok(forth, a.int64, b.int64)) {
+        stack_push(&forth->data_stack, forth_i64(a.int64 % b.int64));
+        stack_push(&forth->data_stack, forth_i64(a.int64 / b.int64));
+    }
 }
 
 // max
@@ -318,258 +608,619 @@ BUILTIN(rshift) {
     stack_push(&forth->data_stack, forth_i64(a.int64 >> b.int64));
 }
 
+// NUMBER OUTPUT
+
+// writes text formatted into a local buffer out in one go
+static void print_text(const char *text, size_t length) {
+    FORTH_OUTPUT("%.*s", (int) length, text);
+}
+
+// writes val in base just before end and returns where it starts, floats
+// are left to the caller
+static char *format_cell(forth_t *forth, char *end, forth_type_t val) {
+    if (val.tag == FORTH_REF) {
+        return format_uint(end, val.ref, forth_base(forth));
+    }
+    return format_int(end, val.int64, forth_base(forth));
+}
+
+// a cell the way . and ? show it, followed by a space
+static void print_cell(forth_t *forth, forth_type_t val) {
+    if (val.tag == FORTH_F64) {
+        FORTH_OUTPUT("%f ", val.float64);
+        return;
+    }
+    char buf[FORMAT_MAX];
+    buf[sizeof(buf) - 1] = ' ';
+    char *start = format_cell(forth, &buf[sizeof(buf) - 1], val);
+    print_text(start, (size_t) (buf + sizeof(buf) - start));
+}
+
+// text right aligned in a field of width, never cut short
+static void print_right(const char *text, size_t length, int64_t width) {
+    for (int64_t pad = width - (int64_t) length; pad > 0; pad--) {
+        FORTH_OUTPUT(" ");
+    }
+    print_text(text, length);
+}
+
+// u.
+BUILTIN(u_period) {
+    forth_type_t val = stack_pop(&forth->data_stack);
+    print_cell(forth, forth_ref((size_t) val.int64));
+}
+
+// .r
+BUILTIN(period_r) {
+    int64_t width = stack_pop(&forth->data_stack).int64;
+    forth_type_t val = stack_pop(&forth->data_stack);
+    char buf[FORMAT_MAX];
+    char *start = format_int(buf + sizeof(buf), val.int64, forth_base(forth));
+    print_right(start, (size_t) (buf + sizeof(buf) - start), width);
+}
+
+// u.r
+BUILTIN(u_period_r) {
+    int64_t width = stack_pop(&forth->data_stack).int64;
+    forth_type_t val = stack_pop(&forth->data_stack);
+    char buf[FORMAT_MAX];
+    char *start = format_uint(buf + sizeof(buf), (uint64_t) val.int64,
+                              forth_base(forth));
+    print_right(start, (size_t) (buf + sizeof(buf) - start), width);
+}
+
+// decimal
+BUILTIN(decimal) {
+    *forth->base = forth_i64(10);
+}
+
+// hex
+BUILTIN(hex) {
+    *forth->base = forth_i64(16);
+}
+
+// s>d
+BUILTIN(s_to_d) {
+    forth_type_t val = stack_peek(&forth->data_stack);
+    stack_push(&forth->data_stack, forth_i64(val.int64 < 0 ? -1 : 0));
+}
+
+// double cells are the low cell with the high cell on top of it
+static format_u128 pop_double(forth_t *forth) {
+    uint64_t high = (uint64_t) stack_pop(&forth->data_stack).int64;
+    uint64_t low = (uint64_t) stack_pop(&forth->data_stack).int64;
+    return ((format_u128) high << 64) | low;
+}
+
+static void push_double(forth_t *forth, format_u128 val) {
+    stack_push(&forth->data_stack, forth_i64((int64_t) (uint64_t) val));
+    stack_push(&forth->data_stack,
+               forth_i64((int64_t) (uint64_t) (val >> 64)));
+}
+
+static void hold_char(forth_t *forth, char c) {
+    if (forth->hold_start == 0) {
+        forth_throw(forth, FORTH_THROW_HOLD_OVERFLOW,
+                    "pictured numeric output overflow");
+        return;
+    }
+    forth->hold[--forth->hold_start] = c;
+}
+
+// <#
+BUILTIN(less_number_sign) {
+    forth->hold_start = FORTH_HOLD_SIZE;
+}
+
+// #
+BUILTIN(number_sign) {
+    format_u128 val = pop_double(forth);
+    unsigned base = forth_base(forth);
+    hold_char(forth, format_digits[val % base]);
+    push_double(forth, val / base);
+}
+
+// #s
+BUILTIN(number_sign_s) {
+    format_u128 val = pop_double(forth);
+    unsigned base = forth_base(forth);
+    do {
+        hold_char(forth, format_digits[val % base]);
+        val /= base;
+    } while (val != 0 && !forth->error);
+    push_double(forth, 0);
+}
+
+// hold
+BUILTIN(hold) {
+    forth_type_t c = stack_pop(&forth->data_stack);
+    hold_char(forth, (char) c.int64);
+}
+
+// holds
+BUILTIN(holds) {
+    int64_t length = stack_pop(&forth->data_stack).int64;
+    forth_type_t addr = stack_pop(&forth->data_stack);
+    if (length <= 0) {
+        return;
+    }
+    const char *text = ref_bytes(forth, addr, length, "holding from");
+    while (text != NULL && length > 0 && !forth->error) {
+        hold_char(forth, text[--length]);
+    }
+}
+
+// sign
+BUILTIN(sign) {
+    forth_type_t val = stack_pop(&forth->data_stack);
+    if (val.int64 < 0) {
+        hold_char(forth, '-');
+    }
+}
+
+// #>
+BUILTIN(number_sign_greater) {
+    pop_double(forth);
+    size_t start = forth->hold_start;
+    stack_push(&forth->data_stack,
+               forth_ref(forth_segment_ref(FORTH_SEGMENT_HOLD, start)));
+    stack_push(&forth->data_stack, forth_i64(FORTH_HOLD_SIZE - start));
+}
+
+// the float on top followed by a space, integers are converted first
+static void print_float(forth_t *forth, enum FORMAT_FLOAT_STYLE style) {
+    forth_type_t val = stack_pop(&forth->data_stack);
+    double f = val.tag == FORTH_F64 ? val.float64 : (double) val.int64;
+    char buf[FORMAT_MAX + 1];
+    size_t length = format_float(buf, f, style);
+    buf[length++] = ' ';
+    print_text(buf, length);
+}
+
+// f.
+BUILTIN(f_period) {
+    print_float(forth, FORMAT_FIXED);
+}
+
+// fs.
+BUILTIN(fs_period) {
+    print_float(forth, FORMAT_SCIENTIFIC);
+}
+
+// fe.
+BUILTIN(fe_period) {
+    print_float(forth, FORMAT_ENGINEERING);
+}
+
 // MEMORY
 
 // @
 BUILTIN(load) {
-    forth_type_t addr = stack_pop(&forth->data_stack);
-    if (addr.tag != FORTH_REF) {
-        FORTH_ERROR_FUNCTION("Error: Loading from non-reference type\n");
+    forth_type_t *cell = ref_bytes(forth, stack_pop(&forth->data_stack),
+                                   sizeof(forth_type_t), "loading from");
+    if (cell != NULL) {
+        stack_push(&forth->data_stack, *cell);
     }
-    stack_push(&forth->data_stack, *(forth_type_t *) addr.ref);
 }
 
 // !
 BUILTIN(store) {
-    forth_type_t addr = stack_pop(&forth->data_stack);
-    if (addr.tag != FORTH_REF) {
-        FORTH_ERROR_FUNCTION("Error: Storing to non-reference type\n");
+    forth_type_t *cell = ref_bytes(forth, stack_pop(&forth->data_stack),
+                                   sizeof(forth_type_t), "storing to");
+    if (cell != NULL) {
+        *cell = stack_pop(&forth->data_stack);
     }
-    forth_type_t val = stack_pop(&forth->data_stack);
-    *(forth_type_t *) addr.ref = val;
 }
 
 // ?
 BUILTIN(load_print) {
+    forth_type_t *cell = ref_bytes(forth, stack_pop(&forth->data_stack),
+                                   sizeof(forth_type_t), "loading from");
+    if (cell != NULL) {
+        print_cell(forth, *cell);
+    }
+}
+
+// c@
+BUILTIN(cload) {
+    uint8_t *byte =
+        ref_bytes(forth, stack_pop(&forth->data_stack), 1, "loading from");
+    if (byte != NULL) {
+        stack_push(&forth->data_stack, forth_i64(*byte));
+    }
+}
+
+// c!
+BUILTIN(cstore) {
+    uint8_t *byte =
+        ref_bytes(forth, stack_pop(&forth->data_stack), 1, "storing to");
+    if (byte != NULL) {
+        *byte = (uint8_t) stack_pop(&forth->data_stack).int64;
+    }
+}
+
+// move ( from to u -- )
+BUILTIN(move) {
+    int64_t len = stack_pop(&forth->data_stack).int64;
+    forth_type_t to = stack_pop(&forth->data_stack);
+    forth_type_t from = stack_pop(&forth->data_stack);
+    if (len <= 0) {
+        return;
+    }
+    void *dest = ref_bytes(forth, to, len, "moving to");
+    void *src = dest ? ref_bytes(forth, from, len, "moving from") : NULL;
+    if (src != NULL) {
+        memmove(dest, src, (size_t) len);
+    }
+}
+
+// fill ( addr u char -- )
+BUILTIN(fill) {
+    int64_t c = stack_pop(&forth->data_stack).int64;
+    int64_t len = stack_pop(&forth->data_stack).int64;
     forth_type_t addr = stack_pop(&forth->data_stack);
-    if (addr.tag != FORTH_REF) {
-        FORTH_ERROR_FUNCTION("Error: Storing to non-reference type\n");
+    void *dest = len > 0 ? ref_bytes(forth, addr, len, "filling") : NULL;
+    if (dest != NULL) {
+        memset(dest, (int) c, (size_t) len);
     }
-    forth_type_t val = *((forth_type_t *) addr.ref);
-    switch (val.tag) {
-    case FORTH_I64:
-        FORTH_OUTPUT_FUNCTION("%lld ", (long long) val.int64);
-        break;
-    case FORTH_F64:
-        FORTH_OUTPUT_FUNCTION("%f ", val.float64);
-        break;
-    case FORTH_REF:
-        FORTH_OUTPUT_FUNCTION("%zu ", val.ref);
-        break;
-    default:
-        FORTH_OUTPUT_FUNCTION("%lld ", (long long) val.int64);
-        break;
+}
+
+// STRINGS
+// a string is an address and a length, slicing words return parts of the
+// string they were given without copying it
+
+// type
+BUILTIN(type) {
+    int64_t len = stack_pop(&forth->data_stack).int64;
+    forth_type_t addr = stack_pop(&forth->data_stack);
+    const char *text = len > 0 ? ref_bytes(forth, addr, len, "typing from")
+                               : NULL;
+    if (text != NULL) {
+        FORTH_OUTPUT("%.*s", (int) len, text);
     }
 }
 
+// compare ( c-addr1 u1 c-addr2 u2 -- n )
+BUILTIN(compare) {
+    int64_t len2 = stack_pop(&forth->data_stack).int64;
+    forth_type_t addr2 = stack_pop(&forth->data_stack);
+    int64_t len1 = stack_pop(&forth->data_stack).int64;
+    forth_type_t addr1 = stack_pop(&forth->data_stack);
+
+    int64_t len = len1 < len2 ? len1 : len2;
+    int cmp = 0;
+    if (len > 0) {
+        const void *text1 = ref_bytes(forth, addr1, len, "comparing");
+        const void *text2 =
+            text1 ? ref_bytes(forth, addr2, len, "comparing") : NULL;
+        if (text2 == NULL) {
+            return;
+        }
+        cmp = memcmp(text1, text2, (size_t) len);
+    }
+    if (cmp == 0) {
+        cmp = (len1 > len2) - (len1 < len2);
+    }
+    stack_push(&forth->data_stack, forth_i64(cmp < 0 ? -1 : cmp > 0));
+}
+
+// search ( c-addr1 u1 c-addr2 u2 -- c-addr3 u3 flag )
+BUILTIN(search) {
+    int64_t len2 = stack_pop(&forth->data_stack).int64;
+    forth_type_t addr2 = stack_pop(&forth->data_stack);
+    int64_t len1 = stack_pop(&forth->data_stack).int64;
+    forth_type_t addr1 = stack_pop(&forth->data_stack);
+
+    int64_t skipped = 0;
+    if (len2 > 0 && len1 >= len2) {
+        const char *text1 = ref_bytes(forth, addr1, len1, "searching");
+        const char *text2 =
+            text1 ? ref_bytes(forth, addr2, len2, "searching") : NULL;
+        if (text2 == NULL) {
+            return;
+        }
+        const char *found =
+            memmem(text1, (size_t) len1, text2, (size_t) len2);
+        skipped = found != NULL ? found - text1 : -1;
+    } else if (len2 > 0) {
+        skipped = -1;
+    }
+
+    if (skipped < 0) {
+        stack_push(&forth->data_stack, addr1);
+        stack_push(&forth->data_stack, forth_i64(len1));
+        stack_push(&forth->data_stack, forth_i64(0));
+        return;
+    }
+    stack_push(&forth->data_stack, forth_ref(addr1.ref + (size_t) skipped));
+    stack_push(&forth->data_stack, forth_i64(len1 - skipped));
+    stack_push(&forth->data_stack, forth_i64(-1));
+}
+
+// scan ( c-addr u char -- c-addr' u' ), the rest starting at char
+BUILTIN(scan) {
+    int c = (int) stack_pop(&forth->data_stack).int64;
+    int64_t len = stack_pop(&forth->data_stack).int64;
+    forth_type_t addr = stack_pop(&forth->data_stack);
+
+    int64_t skipped = len > 0 ? len : 0;
+    if (len > 0) {
+        const char *text = ref_bytes(forth, addr, len, "scanning");
+        if (text == NULL) {
+            return;
+        }
+        const char *found = memchr(text, c, (size_t) len);
+        skipped = found != NULL ? found - text : len;
+    }
+    stack_push(&forth->data_stack, forth_ref(addr.ref + (size_t) skipped));
+    stack_push(&forth->data_stack, forth_i64(len - skipped));
+}
+
+// /string ( c-addr u n -- c-addr+n u-n )
+BUILTIN(slash_string) {
+    int64_t n = stack_pop(&forth->data_stack).int64;
+    int64_t len = stack_pop(&forth->data_stack).int64;
+    forth_type_t addr = stack_pop(&forth->data_stack);
+    stack_push(&forth->data_stack, forth_ref(addr.ref + (size_t) n));
+    stack_push(&forth->data_stack, forth_i64(len - n));
+}
+
+// -trailing
+BUILTIN(dash_trailing) {
+    int64_t len = stack_pop(&forth->data_stack).int64;
+    forth_type_t addr = stack_peek(&forth->data_stack);
+    const char *text = len > 0 ? ref_bytes(forth, addr, len, "trimming")
+                               : NULL;
+    if (len > 0 && text == NULL) {
+        return;
+    }
+    while (len > 0 && text[len - 1] == ' ') {
+        len--;
+    }
+    stack_push(&forth->data_stack, forth_i64(len));
+}
+
 // CONTROL STRUCTURES
 
 // do
 BUILTIN(do) {
-    // stack: ... start limit
-    forth_type_t index = stack_pop(&forth->data_stack);
-    forth_type_t limit = stack_pop(&forth->data_stack);
+    compile_op(forth, OP_DO, 0);
+    control_push(forth, CONTROL_DO, forth->code_length - 1);
+}
 
-    // push loop control values in reverse: limit, index, return address
-    stack_push(&forth->control_stack, limit);
-    stack_push(&forth->control_stack, index);
-    stack_push(&forth->control_stack, forth_ref(*i));
+// ?do
+BUILTIN(qdo) {
+    compile_op(forth, OP_QDO, 0);
+    control_push(forth, CONTROL_DO, forth->code_length - 1);
+}
+
+static void compile_loop(forth_t *forth, enum CONTROL_KIND kind,
+                         enum FORTH_OPCODE op) {
+    size_t start;
+    if (control_pop(forth, kind, &start)) {
+        compile_op(forth, op, (int64_t) (start + 1) - forth->code_length);
+        control_resolve(forth, start);
+    }
 }
 
 // loop
 BUILTIN(loop) {
-    forth_type_t loop_start = stack_pop(&forth->control_stack);
-    forth_type_t index = stack_pop(&forth->control_stack);
-    forth_type_t limit = stack_pop(&forth->control_stack);
-
-    index.int64 += 1;
-
-    if (index.int64 < limit.int64) {
-        stack_push(&forth->control_stack, limit);
-        stack_push(&forth->control_stack, index);
-        stack_push(&forth->control_stack, loop_start);
-        *i = loop_start.ref; // jump back
-    }
+    compile_loop(forth, CONTROL_DO, OP_LOOP);
 }
 
 // +loop
 BUILTIN(add_loop) {
-    int64_t inc = stack_pop(&forth->data_stack).int64;
+    compile_loop(forth, CONTROL_DO, OP_PLUS_LOOP);
+}
 
-    // get control stack top
-    size_t top = forth->control_stack.top;
-    if (top < 3) {
-        FORTH_ERROR_FUNCTION("+loop error: control stack underflow\n");
-        return;
+// -loop
+BUILTIN(sub_loop) {
+    compile_loop(forth, CONTROL_DO, OP_MINUS_LOOP);
+}
+
+// leave
+BUILTIN(leave) {
+    forth_stack_t *control = &forth->control_stack;
+    for (int64_t idx = control->top - 1; idx > forth->compile_base; idx -= 2) {
+        if (control->data[idx].int64 == CONTROL_DO) {
+            compile_op(forth, OP_LEAVE, 0);
+            return;
+        }
+        // iterations of a par-do can't stop each other
+        if (control->data[idx].int64 == CONTROL_PAR) {
+            break;
+        }
     }
 
-    forth_type_t addr_val = forth->control_stack.data[top - 1];
-    forth_type_t index_val = forth->control_stack.data[top - 2];
-    forth_type_t limit_val = forth->control_stack.data[top - 3];
+    forth_throw(forth, FORTH_THROW_CONTROL_MISMATCH,
+                "'leave' outside a loop");
+    forth_abort_compile(forth);
+}
 
-    int64_t new_index = index_val.int64 + inc;
-    int64_t limit = limit_val.int64;
-    size_t start = addr_val.ref;
+// par-do ... par-loop
+BUILTIN(par_do) {
+    compile_op(forth, OP_PAR_DO, 0);
+    control_push(forth, CONTROL_PAR, forth->code_length - 1);
+}
 
-    // pop old values
-    forth->control_stack.top -= 3;
+// par-loop
+BUILTIN(par_loop) {
+    compile_loop(forth, CONTROL_PAR, OP_PAR_LOOP);
+}
 
-    if ((inc > 0 && new_index < limit) || (inc < 0 && new_index > limit)) {
-        // push updated frame
-        stack_push(&forth->control_stack, forth_i64(limit));
-        stack_push(&forth->control_stack, forth_i64(new_index));
-        stack_push(&forth->control_stack, forth_ref(start));
-        *i = start; // jump back to start of loop
-    }
+// par-sum
+BUILTIN(par_sum) {
+    compile_loop(forth, CONTROL_PAR, OP_PAR_SUM);
 }
 
-// leave
-BUILTIN(leave) {
-    // skip until "loop" or "+loop"
-    while (++(*i) < words_length) {
-        if (strequal(words[*i], "loop") || strequal(words[*i], "+loop")) {
+// par-min
+BUILTIN(par_min) {
+    compile_loop(forth, CONTROL_PAR, OP_PAR_MIN);
+}
+
+// par-max
+BUILTIN(par_max) {
+    compile_loop(forth, CONTROL_PAR, OP_PAR_MAX);
+}
+
+// unloop
+BUILTIN(unloop) {
+    forth_stack_t *control = &forth->control_stack;
+    for (int64_t idx = control->top - 1; idx > forth->compile_base; idx -= 2) {
+        if (control->data[idx].int64 == CONTROL_DO) {
+            compile_op(forth, OP_UNLOOP, 0);
+            return;
+        }
+        // a plain exit already ends a par-do chunk
+        if (control->data[idx].int64 == CONTROL_PAR) {
             break;
         }
     }
 
-    // pop loop frame from control stack
-    (void) stack_pop(&forth->control_stack); // index
-    (void) stack_pop(&forth->control_stack); // limit
-    (void) stack_pop(&forth->control_stack); // start idx
+    forth_throw(forth, FORTH_THROW_CONTROL_MISMATCH,
+                "'unloop' outside a loop");
+    forth_abort_compile(forth);
 }
 
 // i
 BUILTIN(i) {
-    size_t top = forth->control_stack.top;
-    if (top >= 2) {
-        forth_type_t index = forth->control_stack.data[top - 2];
+    if (forth->state->int64) {
+        compile_op(forth, OP_I, 0);
+    } else if (forth->loop_top >= 2) {
+        forth_type_t index = forth_i64(forth->loops[forth->loop_top - 1].index);
         stack_push(&forth->data_stack, index);
     } else {
-        FORTH_ERROR_FUNCTION("Error: control stack underflow in 'i'\n");
+        forth_throw(forth, FORTH_THROW_CONTROL_MISMATCH, "'i' outside a loop");
     }
 }
 
 // j
 BUILTIN(j) {
-    size_t top = forth->control_stack.top;
-    if (top >= 5) {
-        forth_type_t index = forth->control_stack.data[top - 5];
+    if (forth->state->int64) {
+        compile_op(forth, OP_J, 0);
+    } else if (forth->loop_top >= 3) {
+        forth_type_t index = forth_i64(forth->loops[forth->loop_top - 2].index);
         stack_push(&forth->data_stack, index);
     } else {
-        FORTH_ERROR_FUNCTION("Error: control stack underflow in 'j'\n");
+        forth_throw(forth, FORTH_THROW_CONTROL_MISMATCH,
+                    "'j' outside a nested loop");
     }
 }
 
 // if
 BUILTIN(if) {
-    int64_t condition = stack_pop(&forth->data_stack).int64;
-    // if false, go to the next "else" or "then", whichever is found
-    // first
-    if (condition == 0) {
-        int64_t depth = 1;
-        while (++(*i) < words_length) {
-            if (strequal(words[*i], "then")) {
-                depth--;
-                if (depth == 0) {
-                    break;
-                }
-            } else if (strequal(words[*i], "else") && depth == 1) {
-                break;
-            }
-        }
-    } else {
-        // true, do nothing
-    }
+    compile_op(forth, OP_0BRANCH, 0);
+    control_push(forth, CONTROL_ORIG, forth->code_length - 1);
 }
 
 // else
 BUILTIN(else) {
-    // skip to then
-    int depth = 1;
-    while (++(*i) < words_length) {
-        if (strcmp(words[*i], "if") == 0) {
-            depth++;
-        } else if (strcmp(words[*i], "then") == 0) {
-            depth--;
-            if (depth == 0) {
-                break;
-            }
-        }
+    size_t orig;
+    if (control_pop(forth, CONTROL_ORIG, &orig)) {
+        compile_op(forth, OP_BRANCH, 0);
+        control_push(forth, CONTROL_ORIG, forth->code_length - 1);
+        control_resolve(forth, orig);
     }
 }
 
 // then
 BUILTIN(then) {
-    // no op
+    size_t orig;
+    if (control_pop(forth, CONTROL_ORIG, &orig)) {
+        control_resolve(forth, orig);
+    }
 }
 
 // begin
 BUILTIN(begin) {
-    stack_push(&forth->control_stack, forth_ref((*i) - 1));
+    control_push(forth, CONTROL_DEST, forth->code_length);
 }
 
 // again
 BUILTIN(again) {
-    *i = stack_pop(&forth->control_stack).ref;
+    size_t dest;
+    if (control_pop(forth, CONTROL_DEST, &dest)) {
+        compile_op(forth, OP_BRANCH, (int64_t) dest - forth->code_length);
+    }
 }
 
 // until
 BUILTIN(until) {
-    int64_t flag = stack_pop(&forth->data_stack).int64;
-    if (flag == 0) {
-        *i = stack_pop(&forth->control_stack).ref;
-    } else {
-        (void) stack_pop(&forth->control_stack);
+    size_t dest;
+    if (control_pop(forth, CONTROL_DEST, &dest)) {
+        compile_op(forth, OP_0BRANCH, (int64_t) dest - forth->code_length);
+    }
+}
+
+// while
+BUILTIN(while) {
+    size_t dest;
+    if (control_pop(forth, CONTROL_DEST, &dest)) {
+        compile_op(forth, OP_0BRANCH, 0);
+        control_push(forth, CONTROL_ORIG, forth->code_length - 1);
+        control_push(forth, CONTROL_DEST, dest);
+    }
+}
+
+// repeat
+BUILTIN(repeat) {
+    size_t dest, orig;
+    if (control_pop(forth, CONTROL_DEST, &dest) &&
+        control_pop(forth, CONTROL_ORIG, &orig)) {
+        compile_op(forth, OP_BRANCH, (int64_t) dest - forth->code_length);
+        control_resolve(forth, orig);
     }
 }
 
 // cr
 BUILTIN(cr) {
-    FORTH_OUTPUT_FUNCTION("\n");
+    FORTH_OUTPUT("\n");
 }
 
 // emit
 BUILTIN(emit) {
     forth_type_t val = stack_pop(&forth->data_stack);
-    FORTH_OUTPUT_FUNCTION("%c", (char) val.int64);
+    FORTH_OUTPUT("%c", (char) val.int64);
 }
 
 // space
 BUILTIN(space) {
-    FORTH_OUTPUT_FUNCTION(" ");
+    FORTH_OUTPUT(" ");
 }
 
 // spaces
 BUILTIN(spaces) {
     forth_type_t val = stack_pop(&forth->data_stack);
     for (int64_t idx = 0; idx < val.int64; idx++) {
-        FORTH_OUTPUT_FUNCTION(" ");
+        FORTH_OUTPUT(" ");
     }
 }
 
 // page
 BUILTIN(page) {
     // ANSI clear followed by ANSI cursor home
-    FORTH_OUTPUT_FUNCTION("\033[2J\033[H");
+    FORTH_OUTPUT("\033[2J\033[H");
 }
 
 // dump
 BUILTIN(dump) {
-    FORTH_OUTPUT_FUNCTION("Stack dump: \n");
+    FORTH_OUTPUT("Stack dump: \n");
     for (int64_t idx = forth->data_stack.top - 1; idx >= 0; idx--) {
         forth_type_t val = forth->data_stack.data[idx];
         switch (val.tag) {
         case FORTH_I64:
-            FORTH_OUTPUT_FUNCTION("%lld (I64)\n", (long long) val.int64);
+        case FORTH_REF: {
+            char buf[FORMAT_MAX];
+            char *start = format_cell(forth, buf + sizeof(buf), val);
+            FORTH_OUTPUT("%.*s (%s)\n", (int) (buf + sizeof(buf) - start),
+                         start, val.tag == FORTH_I64 ? "I64" : "REF");
             break;
+        }
         case FORTH_F64:
-            FORTH_OUTPUT_FUNCTION("%f (F64)\n", val.float64);
-            break;
-        case FORTH_REF:
-            FORTH_OUTPUT_FUNCTION("%zu (REF)\n", val.ref);
+            FORTH_OUTPUT("%f (F64)\n", val.float64);
             break;
         default:
-            FORTH_OUTPUT_FUNCTION("%zu (BAD TAG (%d))\n", val.ref, val.tag);
+            FORTH_OUTPUT("%zu (BAD TAG (%d))\n", val.ref, val.tag);
             break;
         }
     }
@@ -577,45 +1228,441 @@ BUILTIN(dump) {
 
 // .
 BUILTIN(period) {
-    forth_type_t val = stack_pop(&forth->data_stack);
-    if (val.tag == FORTH_I64) {
-        FORTH_OUTPUT_FUNCTION("%lld ", (long long) val.int64);
-    } else if (val.tag == FORTH_F64) {
-        FORTH_OUTPUT_FUNCTION("%f ", val.float64);
-    } else if (val.tag == FORTH_REF) {
-        FORTH_OUTPUT_FUNCTION("%zu ", val.ref);
-    }
+    print_cell(forth, stack_pop(&forth->data_stack));
 }
 
 // variable
 BUILTIN(variable) {
-    char *variable_name = words[++(*i)];
-    forth_type_t *addr = (forth_type_t *) &forth->heap[forth->next_address];
-    forth->next_address += sizeof(forth_type_t);
-    addr->tag = FORTH_I64;
-    addr->int64 = 0;
-    forth_define_variable(forth, variable_name, addr);
+    char variable_name[MAX_WORD_LENGTH];
+    if (!parse_name(forth, variable_name, sizeof(variable_name), "variable") ||
+        !valid_name(forth, variable_name)) {
+        return;
+    }
+
+    size_t offset = heap_reserve(forth, sizeof(forth_type_t), "variable");
+    if (offset == SIZE_MAX) {
+        return;
+    }
+    *(forth_type_t *) (forth->heap + offset) = forth_i64(0);
+    trie_insert_variable(forth, variable_name, forth_ref(offset));
 }
 
 // include
 BUILTIN(include) {
-    char *filename = words[++(*i)];
-    forth_import_file(forth, filename);
+    char filename[MAX_WORD_LENGTH];
+    if (parse_name(forth, filename, sizeof(filename), "include")) {
+        forth_import_file(forth, filename);
+    }
 }
 
 // ref
 BUILTIN(ref) {
-    char *ref_str = words[++(*i)];
+    char ref_str[MAX_WORD_LENGTH];
     char *endptr;
+    if (!parse_name(forth, ref_str, sizeof(ref_str), "ref")) {
+        return;
+    }
 
     errno = 0;
     size_t ref = (size_t) strtoumax(ref_str, &endptr, 10);
     if (errno != 0) {
-        FORTH_ERROR_FUNCTION("Failed to convert word '%s' to reference\n",
-                             ref_str);
+        forth_throw(forth, FORTH_THROW_INVALID_ARGUMENT,
+                    "failed to convert word '%s' to reference", ref_str);
+        forth_abort_compile(forth);
+        return;
     }
     forth_type_t val = forth_ref(ref);
-    stack_push(&forth->data_stack, val);
+    if (forth->state->int64) {
+        forth_compile(forth,
+                      (forth_instr_t) {.op = OP_LITERAL, .literal = val});
+    } else {
+        stack_push(&forth->data_stack, val);
+    }
+}
+
+// the execution token of node, nodes get the next index the first time
+static forth_type_t xt_of(forth_t *forth, trie_node_t *node) {
+    if (node->xt == 0 && par_capture != NULL) {
+        // the table is the parent's while a par-do runs
+        forth_throw(forth, FORTH_THROW_UNSUPPORTED,
+                    "new execution token inside par-do");
+        return forth_ref(0);
+    }
+    if (node->xt == 0) {
+        if (forth->xt_count == forth->xt_capacity) {
+            forth->xt_capacity = forth->xt_capacity ? forth->xt_capacity * 2
+                                                    : 64;
+            forth->xts = realloc(forth->xts, sizeof(trie_node_t *) *
+                                                 forth->xt_capacity);
+        }
+        forth->xts[forth->xt_count++] = node;
+        node->xt = (uint32_t) forth->xt_count;
+    }
+    return forth_ref(forth_segment_ref(FORTH_SEGMENT_XT, node->xt - 1));
+}
+
+// ' <name> and ['] <name>, an execution token indexes the nodes in forth->xts
+BUILTIN(tick) {
+    char name[MAX_WORD_LENGTH];
+    if (!parse_name(forth, name, sizeof(name), "'")) {
+        return;
+    }
+
+    trie_node_t *node = trie_search(forth->root, name);
+    if (node == NULL || node->node_type == TRIE_NONE) {
+        forth_throw(forth, FORTH_THROW_UNDEFINED_WORD, "word '%s' undefined",
+                    name);
+        forth_abort_compile(forth);
+        return;
+    }
+
+    forth_type_t xt = xt_of(forth, node);
+    if (forth->state->int64) {
+        forth_compile(forth, (forth_instr_t) {.op = OP_LITERAL, .literal = xt});
+    } else {
+        stack_push(&forth->data_stack, xt);
+    }
+}
+
+// TASKS
+
+// pause
+BUILTIN(pause) {
+    if (forth->state->int64) {
+        compile_op(forth, OP_PAUSE, 0);
+    } else {
+        forth_run(forth, task_pause_code, NULL);
+    }
+}
+
+// task-spawn <name>
+BUILTIN(task_spawn) {
+    char name[MAX_WORD_LENGTH];
+    if (!parse_name(forth, name, sizeof(name), "task-spawn")) {
+        return;
+    }
+
+    trie_node_t *node = trie_search(forth->root, name);
+    if (node == NULL || node->node_type != TRIE_USERWORD) {
+        forth_throw(forth, FORTH_THROW_INVALID_ARGUMENT,
+                    "'%s' can't run as a task", name);
+        forth_abort_compile(forth);
+        return;
+    }
+
+    if (forth->state->int64) {
+        forth_compile(forth, (forth_instr_t) {.op = OP_SPAWN, .node = node});
+    } else {
+        stack_push(&forth->data_stack, forth_i64(task_spawn(forth, node)));
+    }
+}
+
+// task-join
+BUILTIN(task_join) {
+    if (forth->state->int64) {
+        compile_op(forth, OP_JOIN, 0);
+    } else {
+        forth_run(forth, task_join_code, NULL);
+    }
+}
+
+// task-done?
+BUILTIN(task_done) {
+    int64_t id = stack_pop(&forth->data_stack).int64;
+    int done = forth->tasks != NULL && id > 0 && id < forth->task_count &&
+               forth->tasks[id].state == TASK_DONE;
+    stack_push(&forth->data_stack, forth_i64(done ? -1 : 0));
+}
+
+// FILES
+
+// the name on the stack as a c string, 0 with errno set if it doesn't fit
+// or isn't in memory forth can address
+static int file_name(forth_t *forth, char *buf, size_t size) {
+    int64_t len = stack_pop(&forth->data_stack).int64;
+    forth_type_t addr = stack_pop(&forth->data_stack);
+    if (len < 0 || (size_t) len >= size) {
+        errno = ENAMETOOLONG;
+        return 0;
+    }
+    const char *name = forth_addr(forth, addr.ref, (size_t) len);
+    if (addr.tag != FORTH_REF || name == NULL) {
+        errno = EFAULT;
+        return 0;
+    }
+    memcpy(buf, name, (size_t) len);
+    buf[len] = '\0';
+    return 1;
+}
+
+static void file_open(forth_t *forth, int flags) {
+    int64_t fam = stack_pop(&forth->data_stack).int64;
+    char name[PATH_MAX];
+    int fd = -1;
+
+    if (file_name(forth, name, sizeof(name))) {
+        fd = open(name, (int) fam | flags | O_CLOEXEC, 0666);
+    }
+    stack_push(&forth->data_stack, forth_i64(fd));
+    stack_push(&forth->data_stack, forth_i64(fd < 0 ? -errno : 0));
+}
+
+// r/o
+BUILTIN(read_only) {
+    stack_push(&forth->data_stack, forth_i64(O_RDONLY));
+}
+
+// w/o
+BUILTIN(write_only) {
+    stack_push(&forth->data_stack, forth_i64(O_WRONLY));
+}
+
+// r/w
+BUILTIN(read_write) {
+    stack_push(&forth->data_stack, forth_i64(O_RDWR));
+}
+
+// open-file
+BUILTIN(open_file) {
+    file_open(forth, 0);
+}
+
+// create-file
+BUILTIN(create_file) {
+    file_open(forth, O_CREAT | O_TRUNC);
+}
+
+// close-file
+BUILTIN(close_file) {
+    int fd = (int) stack_pop(&forth->data_stack).int64;
+    int ior = close(fd) < 0 ? -errno : 0;
+    stack_push(&forth->data_stack, forth_i64(ior));
+}
+
+// file-size
+BUILTIN(file_size) {
+    int fd = (int) stack_pop(&forth->data_stack).int64;
+    struct stat st;
+    int ior = fstat(fd, &st) < 0 ? -errno : 0;
+    stack_push(&forth->data_stack, forth_i64(ior ? 0 : st.st_size));
+    stack_push(&forth->data_stack, forth_i64(ior));
+}
+
+static forth_type_t forth_new_region(forth_t *forth, void *base, size_t size,
+                                     int mapped);
+static forth_segment_t *forth_region(forth_t *forth, forth_type_t ref);
+static int forth_drop_region(forth_segment_t *region);
+
+// map-file ( c-addr u fam -- addr len ior ), r/w mappings write through to
+// the file
+BUILTIN(map_file) {
+    int64_t fam = stack_pop(&forth->data_stack).int64;
+    char name[PATH_MAX];
+    forth_type_t addr = forth_ref(0);
+    size_t len = 0;
+    int ior = 0;
+
+    int fd = -1;
+    if (file_name(forth, name, sizeof(name))) {
+        fd = open(name, (int) fam | O_CLOEXEC);
+    }
+    if (fd < 0) {
+        ior = -errno;
+    }
+
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) < 0) {
+        ior = -errno;
+    } else if (fd >= 0 && st.st_size > 0) {
+        int prot = fam == O_RDONLY ? PROT_READ : PROT_READ | PROT_WRITE;
+        void *map = mmap(NULL, (size_t) st.st_size, prot, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            ior = -errno;
+        } else {
+            // the mapping is a segment of its own
+            len = (size_t) st.st_size;
+            addr = forth_new_region(forth, map, len, 1);
+            if (forth->error) {
+                munmap(map, len);
+                len = 0;
+            }
+        }
+    }
+
+    // the mapping outlives the descriptor
+    if (fd >= 0) {
+        close(fd);
+    }
+    stack_push(&forth->data_stack, addr);
+    stack_push(&forth->data_stack, forth_i64((int64_t) len));
+    stack_push(&forth->data_stack, forth_i64(ior));
+}
+
+// unmap-file ( addr len -- ior ), the whole mapping addr is the start of
+BUILTIN(unmap_file) {
+    int64_t len = stack_pop(&forth->data_stack).int64;
+    forth_type_t addr = stack_pop(&forth->data_stack);
+    forth_segment_t *region = forth_region(forth, addr);
+    int ior = 0;
+    if (par_capture != NULL) {
+        forth_throw(forth, FORTH_THROW_UNSUPPORTED,
+                    "unmap-file inside par-do");
+    } else if (len <= 0) {
+        ior = 0;
+    } else if (region == NULL || region->mapping == NULL) {
+        ior = -EINVAL;
+    } else {
+        // a clone still using the mapping keeps it
+        ior = forth_drop_region(region);
+    }
+    stack_push(&forth->data_stack, forth_i64(ior));
+}
+
+// addr len -- ior, widens the range to whole pages
+static void map_advise(forth_t *forth, int advice) {
+    int64_t len = stack_pop(&forth->data_stack).int64;
+    forth_type_t ref = stack_pop(&forth->data_stack);
+
+    int ior = 0;
+    if (len > 0) {
+        void *host = forth_addr(forth, ref.ref, (size_t) len);
+        uintptr_t addr = (uintptr_t) host;
+        uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+        uintptr_t start = addr & ~(page - 1);
+        if (ref.tag != FORTH_REF || host == NULL) {
+            ior = -EFAULT;
+        } else if (madvise((void *) start, addr - start + (size_t) len,
+                           advice) < 0) {
+            ior = -errno;
+        }
+    }
+    stack_push(&forth->data_stack, forth_i64(ior));
+}
+
+// map-sequential
+BUILTIN(map_sequential) {
+    map_advise(forth, MADV_SEQUENTIAL);
+}
+
+// map-willneed
+BUILTIN(map_willneed) {
+    map_advise(forth, MADV_WILLNEED);
+}
+
+// map-random
+BUILTIN(map_random) {
+    map_advise(forth, MADV_RANDOM);
+}
+
+// c-addr u offset fileid -- req
+static void file_submit(forth_t *forth, int write, const char *word) {
+    int fd = (int) stack_pop(&forth->data_stack).int64;
+    int64_t offset = stack_pop(&forth->data_stack).int64;
+    int64_t len = stack_pop(&forth->data_stack).int64;
+    forth_type_t addr = stack_pop(&forth->data_stack);
+    int64_t id = 0;
+
+    // the request table belongs to the interpreter, not to par-do workers
+    void *buf = NULL;
+    if (par_capture != NULL) {
+        forth_throw(forth, FORTH_THROW_UNSUPPORTED, "%s inside par-do", word);
+    } else if (len < 0 || offset < 0) {
+        forth_throw(forth, FORTH_THROW_INVALID_ARGUMENT,
+                    "%s with a negative length or offset", word);
+    } else if (len > UINT32_MAX) {
+        // io_uring takes 32 bit lengths, and a read stops short of 2 GiB
+        // anyway
+        forth_throw(forth, FORTH_THROW_INVALID_ARGUMENT,
+                    "%s of 4 GiB or more", word);
+    } else if ((buf = ref_bytes(forth, addr, len, word)) != NULL) {
+        if (forth->aio == NULL) {
+            forth->aio = aio_create();
+        }
+        id = aio_submit(forth->aio, fd, write, buf, (size_t) len,
+                        (uint64_t) offset);
+        if (id == 0) {
+            forth_throw(forth, FORTH_THROW_FILE_IO,
+                        "%s with %d requests in flight", word,
+                        FORTH_AIO_DEPTH);
+        }
+    }
+    stack_push(&forth->data_stack, forth_i64(id));
+}
+
+// read-file-async
+BUILTIN(read_file_async) {
+    file_submit(forth, 0, "read-file-async");
+}
+
+// write-file-async
+BUILTIN(write_file_async) {
+    file_submit(forth, 1, "write-file-async");
+}
+
+// await
+BUILTIN(await) {
+    if (forth->state->int64) {
+        compile_op(forth, OP_AWAIT, 0);
+    } else {
+        forth_run(forth, aio_await_code, NULL);
+    }
+}
+
+// RANDOM NUMBERS
+
+// seed ( n -- )
+BUILTIN(seed) {
+    forth_type_t val = stack_pop(&forth->data_stack);
+    random_seed(forth->random, (uint64_t) val.int64);
+}
+
+// random ( u -- u' ), below u or any cell for 0
+BUILTIN(random) {
+    forth_type_t bound = stack_pop(&forth->data_stack);
+    uint64_t n = random_below(forth->random, (uint64_t) bound.int64);
+    stack_push(&forth->data_stack, forth_i64((int64_t) n));
+}
+
+// frandom ( -- f ), in [0, 1)
+BUILTIN(frandom) {
+    stack_push(&forth->data_stack, forth_f64(random_double(forth->random)));
+}
+
+// random-fill ( addr n bound -- ), n cells of integers below an integer
+// bound (any cell for 0) or floats below a float one
+BUILTIN(random_fill) {
+    forth_type_t bound = stack_pop(&forth->data_stack);
+    int64_t count = stack_pop(&forth->data_stack).int64;
+    forth_type_t addr = stack_pop(&forth->data_stack);
+    if (count <= 0) {
+        return;
+    }
+    if ((uint64_t) count > INT64_MAX / sizeof(forth_type_t)) {
+        forth_throw(forth, FORTH_THROW_OUT_OF_RANGE, "filling %" PRId64
+                    " cells", count);
+        return;
+    }
+    forth_type_t *cells =
+        ref_bytes(forth, addr, count * (int64_t) sizeof(forth_type_t),
+                  "filling");
+    if (cells == NULL) {
+        return;
+    }
+
+    // a local copy of the state stays in registers across the loop
+    uint64_t s[4];
+    memcpy(s, forth->random, sizeof(s));
+    if (bound.tag == FORTH_F64) {
+        for (int64_t n = 0; n < count; n++) {
+            cells[n] = forth_f64(random_double(s) * bound.float64);
+        }
+    } else {
+        uint64_t below = (uint64_t) bound.int64;
+        for (int64_t n = 0; n < count; n++) {
+            cells[n] = forth_i64((int64_t) random_below(s, below));
+        }
+    }
+    memcpy(forth->random, s, sizeof(s));
 }
 
 // FLOATING POINT
@@ -898,10 +1945,74 @@ BUILTIN(bye) {
 
 // throw
 BUILTIN(throw) {
-    int64_t err = stack_pop(&forth->data_stack).int64;
-    if (err != 0) {
-        exit(err);
+    int64_t code = stack_pop(&forth->data_stack).int64;
+    // the codes the host reads as a suspension or as running out of fuel
+    // only come from the interpreter itself
+    if (code < INT_MIN || code > INT_MAX || code == FORTH_SUSPENDED ||
+        code == FORTH_THROW_OUT_OF_FUEL) {
+        forth_throw(forth, FORTH_THROW_OUT_OF_RANGE,
+                    "throw code %" PRId64 " is out of range or reserved",
+                    code);
+    } else if (code != 0) {
+        forth_throw(forth, (int) code, "uncaught throw %" PRId64, code);
+    }
+}
+
+// abort
+BUILTIN(abort) {
+    forth_throw(forth, FORTH_THROW_ABORT, "aborted");
+}
+
+static void forth_execute(forth_t *forth, trie_node_t *node);
+static void forth_abandon(forth_t *forth);
+
+// execute ( xt -- )
+BUILTIN(execute) {
+    forth_type_t xt = stack_pop(&forth->data_stack);
+    size_t idx = xt.ref - forth_segment_ref(FORTH_SEGMENT_XT, 0);
+    if (xt.tag != FORTH_REF || idx >= forth->xt_count) {
+        forth_throw(forth, FORTH_THROW_INVALID_ADDRESS,
+                    "executing something that isn't an execution token");
+        return;
     }
+    forth_execute(forth, forth->xts[idx]);
+}
+
+// catch ( xt -- code ), the word runs in a nested forth_run that unwinds its
+// own frames on a throw, so all catch keeps are the depths to go back to
+BUILTIN(catch) {
+    forth_stack_t *data = &forth->data_stack;
+    forth_type_t xt = stack_pop(data);
+    if (forth_check(forth)) {
+        return;
+    }
+
+    int64_t data_top = data->top;
+    int64_t control_top = forth->control_stack.top;
+    int64_t loop_top = forth->loop_top;
+
+    stack_push(data, xt);
+    forth_builtin_execute(forth);
+
+    // typed at the prompt the word ran as the outermost run and stopped
+    // instead of throwing, but nothing could pick up after catch
+    if (forth->suspended.ip != NULL) {
+        forth_abandon(forth);
+        forth_throw(forth, FORTH_THROW_OUT_OF_FUEL, "out of fuel");
+    }
+
+    // running out of fuel can't be caught, the host decides what happens
+    int code = forth_check(forth);
+    if (code == FORTH_THROW_OUT_OF_FUEL) {
+        return;
+    }
+    if (code) {
+        forth->error = 0;
+        data->top = data_top;
+        forth->control_stack.top = control_top;
+        forth->loop_top = loop_top;
+    }
+    stack_push(data, forth_i64(code));
 }
 
 // >r
@@ -924,12 +2035,71 @@ BUILTIN(rpop) {
 
 // ."
 BUILTIN(print) {
-    // read until "
-    while (strcmp(words[++(*i)], "\"") != 0) {
-        FORTH_OUTPUT_FUNCTION("%s ", words[*i]);
+    size_t len;
+    const char *text = forth_parse(forth, '"', &len);
+
+    if (forth->state->int64) {
+        forth_compile(forth, (forth_instr_t) {
+                                 .op = OP_PRINT,
+                                 .string = strndup(text, len),
+                             });
+    } else {
+        FORTH_OUTPUT("%.*s", (int) len, text);
     }
 }
 
+// s" string", copied into the heap when compiled and into the transient
+// area when interpreted
+BUILTIN(s_quote) {
+    size_t len;
+    const char *text = forth_parse(forth, '"', &len);
+
+    size_t addr;
+    if (forth->state->int64) {
+        // compiled strings live as long as the word, so they go on the heap
+        addr = heap_reserve(forth, len, "s\"");
+        if (addr == SIZE_MAX) {
+            return;
+        }
+        memcpy(&forth->heap[addr], text, len);
+    } else {
+        if (len > FORTH_TRANSIENT_SIZE) {
+            forth_throw(forth, FORTH_THROW_STRING_OVERFLOW,
+                        "s\" string too long");
+            return;
+        }
+        if (len > FORTH_TRANSIENT_SIZE - forth->transient_next) {
+            forth->transient_next = 0;
+        }
+        memcpy(&forth->transient[forth->transient_next], text, len);
+        addr = forth_segment_ref(FORTH_SEGMENT_TRANSIENT,
+                                 forth->transient_next);
+        forth->transient_next += len;
+    }
+
+    forth_type_t vals[] = {forth_ref(addr), forth_i64((int64_t) len)};
+    for (size_t n = 0; n < 2; n++) {
+        if (forth->state->int64) {
+            forth_compile(forth, (forth_instr_t) {.op = OP_LITERAL,
+                                                  .literal = vals[n]});
+        } else {
+            stack_push(&forth->data_stack, vals[n]);
+        }
+    }
+}
+
+// ( comment )
+BUILTIN(paren) {
+    size_t len;
+    (void) forth_parse(forth, ')', &len);
+}
+
+// \ comment
+BUILTIN(backslash) {
+    size_t len;
+    (void) forth_parse(forth, '\n', &len);
+}
+
 // cells
 BUILTIN(cells) {
     forth_type_t val = stack_pop(&forth->data_stack);
@@ -940,23 +2110,33 @@ BUILTIN(cells) {
 // allocate
 BUILTIN(allocate) {
     forth_type_t size = stack_pop(&forth->data_stack);
-    forth_type_t addr = forth_ref((size_t) &forth->next_address);
+    forth_type_t addr = forth_ref(forth->next_address);
 
     forth_type_t ior = forth_i64(0);
 
-    // align to nearest cell
-    size_t alignment = sizeof(forth_type_t);
+    // a negative size is the only way back down, so the peak is kept here
+    if (forth->stats.heap_peak < forth->next_address) {
+        forth->stats.heap_peak = forth->next_address;
+    }
+    forth->stats.allocations++;
 
     switch (size.tag) {
     case FORTH_REF:
-        forth->next_address += size.ref;
-        forth->next_address =
-            (forth->next_address + alignment - 1) & ~(alignment - 1);
+        (void) heap_reserve(forth, size.ref, "allocate");
         break;
     case FORTH_I64:
-        forth->next_address += (size_t) size.int64;
-        forth->next_address =
-            (forth->next_address + alignment - 1) & ~(alignment - 1);
+        if (size.int64 >= 0) {
+            (void) heap_reserve(forth, (size_t) size.int64, "allocate");
+        } else if (0 - (uint64_t) size.int64 <= forth->next_address) {
+            // align to nearest cell
+            size_t alignment = sizeof(forth_type_t);
+            forth->next_address -= 0 - (uint64_t) size.int64;
+            forth->next_address =
+                (forth->next_address + alignment - 1) & ~(alignment - 1);
+        } else {
+            forth_throw(forth, FORTH_THROW_OUT_OF_RANGE,
+                        "allocate: freeing more than the heap holds");
+        }
         break;
     default:
         FORTH_ERROR_FUNCTION("Invalid size type for allocate\n");
@@ -969,10 +2149,105 @@ BUILTIN(allocate) {
     stack_push(&forth->data_stack, ior);
 }
 
+// .stats
+BUILTIN(print_stats) {
+    forth_stats_t stats = forth_get_stats(forth);
+    FORTH_OUTPUT("words executed     %" PRIu64 "\n", stats.words_executed);
+    FORTH_OUTPUT("  user calls       %" PRIu64 "\n", stats.user_calls);
+    FORTH_OUTPUT("  builtin calls    %" PRIu64 "\n", stats.builtin_calls);
+    FORTH_OUTPUT("  ffi calls        %" PRIu64 "\n", stats.ffi_calls);
+    FORTH_OUTPUT("data stack max     %" PRId64 " of %" PRId64 " cells\n",
+                 stats.data_stack_max,
+                 forth->data_stack.size / (int64_t) sizeof(forth_type_t));
+    FORTH_OUTPUT("control stack max  %" PRId64 " of %" PRId64 " cells\n",
+                 stats.control_stack_max,
+                 forth->control_stack.size / (int64_t) sizeof(forth_type_t));
+    FORTH_OUTPUT("heap used          %zu of %zu bytes, peak %zu\n",
+                 stats.heap_used, stats.heap_size, stats.heap_peak);
+    FORTH_OUTPUT("allocations        %" PRIu64 "\n", stats.allocations);
+    FORTH_OUTPUT("dictionary         %zu nodes, %zu bytes\n",
+                 stats.dictionary_nodes, stats.dictionary_bytes);
+    FORTH_OUTPUT("evals              %" PRIu64 ", %.3f ms\n", stats.evals,
+                 (double) stats.eval_ns / 1e6);
+}
+
+// stats-reset
+BUILTIN(stats_reset) {
+    forth_reset_stats(forth);
+}
+
+// PROFILING
+
+// profile-on
+BUILTIN(profile_on) {
+    forth_profile_start(forth);
+}
+
+// profile-off
+BUILTIN(profile_off) {
+    forth_profile_stop(forth);
+}
+
+// profile-reset
+BUILTIN(profile_reset) {
+    forth_profile_reset(forth);
+}
+
+// profile-report
+BUILTIN(profile_report) {
+    forth_profile_report(forth);
+}
+
+// profile-folded
+BUILTIN(profile_folded) {
+    char filename[MAX_WORD_LENGTH];
+    if (parse_name(forth, filename, sizeof(filename), "profile-folded")) {
+        forth_profile_write_folded(forth, filename);
+    }
+}
+
+// sample-on
+BUILTIN(sample_on) {
+    forth_sample_start(forth, 0);
+}
+
+// sample-off
+BUILTIN(sample_off) {
+    forth_sample_stop(forth);
+}
+
+// sample-reset
+BUILTIN(sample_reset) {
+    forth_sample_reset(forth);
+}
+
+// sample-report
+BUILTIN(sample_report) {
+    forth_sample_report(forth);
+}
+
+// sample-folded
+BUILTIN(sample_folded) {
+    char filename[MAX_WORD_LENGTH];
+    if (parse_name(forth, filename, sizeof(filename), "sample-folded")) {
+        forth_sample_write_folded(forth, filename);
+    }
+}
+
 #pragma GCC diagnostic pop
 
 void forth_register_all_builtins(forth_t *forth) {
     REGISTER(":", colon);
+    REGISTER_COMPILE_ONLY(";", semicolon);
+    REGISTER_COMPILE_ONLY("recurse", recurse);
+    REGISTER_COMPILE_ONLY("exit", exit);
+    REGISTER("immediate", immediate);
+    REGISTER_COMPILE_ONLY("[", lbracket);
+    REGISTER_IMMEDIATE("]", rbracket);
+    REGISTER_COMPILE_ONLY("literal", literal);
+    REGISTER("constant", constant);
+    REGISTER("value", value);
+    REGISTER_IMMEDIATE("to", to);
     REGISTER("dup", dup);
     REGISTER("drop", drop);
     REGISTER("swap", swap);
@@ -981,6 +2256,10 @@ void forth_register_all_builtins(forth_t *forth) {
     REGISTER("pick", pick);
     REGISTER("roll", roll);
     REGISTER("?dup", cmp_dup);
+    REGISTER("2dup", two_dup);
+    REGISTER("2drop", two_drop);
+    REGISTER("2swap", two_swap);
+    REGISTER("2over", two_over);
     REGISTER("depth", depth);
     REGISTER("<", lt);
     REGISTER("=", eq);
@@ -1012,19 +2291,39 @@ void forth_register_all_builtins(forth_t *forth) {
     REGISTER("rshift", rshift);
     REGISTER("@", load);
     REGISTER("!", store);
+    REGISTER("c@", cload);
+    REGISTER("c!", cstore);
+    REGISTER("move", move);
+    REGISTER("fill", fill);
+    REGISTER("type", type);
+    REGISTER("compare", compare);
+    REGISTER("search", search);
+    REGISTER("scan", scan);
+    REGISTER("/string", slash_string);
+    REGISTER("-trailing", dash_trailing);
     REGISTER("?", load_print);
-    REGISTER("do", do);
-    REGISTER("loop", loop);
-    REGISTER("+loop", add_loop);
-    REGISTER("leave", leave);
-    REGISTER("i", i);
-    REGISTER("j", j);
-    REGISTER("if", if);
-    REGISTER("else", else);
-    REGISTER("then", then);
-    REGISTER("begin", begin);
-    REGISTER("again", again);
-    REGISTER("until", until);
+    REGISTER_COMPILE_ONLY("do", do);
+    REGISTER_COMPILE_ONLY("?do", qdo);
+    REGISTER_COMPILE_ONLY("loop", loop);
+    REGISTER_COMPILE_ONLY("+loop", add_loop);
+    REGISTER_COMPILE_ONLY("-loop", sub_loop);
+    REGISTER_COMPILE_ONLY("leave", leave);
+    REGISTER_COMPILE_ONLY("unloop", unloop);
+    REGISTER_COMPILE_ONLY("par-do", par_do);
+    REGISTER_COMPILE_ONLY("par-loop", par_loop);
+    REGISTER_COMPILE_ONLY("par-sum", par_sum);
+    REGISTER_COMPILE_ONLY("par-min", par_min);
+    REGISTER_COMPILE_ONLY("par-max", par_max);
+    REGISTER_IMMEDIATE("i", i);
+    REGISTER_IMMEDIATE("j", j);
+    REGISTER_COMPILE_ONLY("if", if);
+    REGISTER_COMPILE_ONLY("else", else);
+    REGISTER_COMPILE_ONLY("then", then);
+    REGISTER_COMPILE_ONLY("begin", begin);
+    REGISTER_COMPILE_ONLY("again", again);
+    REGISTER_COMPILE_ONLY("until", until);
+    REGISTER_COMPILE_ONLY("while", while);
+    REGISTER_COMPILE_ONLY("repeat", repeat);
     REGISTER("cr", cr);
     REGISTER("emit", emit);
     REGISTER("space", space);
@@ -1032,9 +2331,46 @@ void forth_register_all_builtins(forth_t *forth) {
     REGISTER("page", page);
     REGISTER("dump", dump);
     REGISTER(".", period);
+    REGISTER("u.", u_period);
+    REGISTER(".r", period_r);
+    REGISTER("u.r", u_period_r);
+    REGISTER("decimal", decimal);
+    REGISTER("hex", hex);
+    REGISTER("s>d", s_to_d);
+    REGISTER("<#", less_number_sign);
+    REGISTER("#", number_sign);
+    REGISTER("#s", number_sign_s);
+    REGISTER("hold", hold);
+    REGISTER("holds", holds);
+    REGISTER("sign", sign);
+    REGISTER("#>", number_sign_greater);
+    REGISTER("f.", f_period);
+    REGISTER("fs.", fs_period);
+    REGISTER("fe.", fe_period);
     REGISTER("variable", variable);
     REGISTER("include", include);
-    REGISTER("ref", ref);
+    REGISTER_IMMEDIATE("ref", ref);
+    REGISTER_IMMEDIATE("'", tick);
+    REGISTER_COMPILE_ONLY("[']", tick);
+    REGISTER_IMMEDIATE("pause", pause);
+    REGISTER_IMMEDIATE("task-spawn", task_spawn);
+    REGISTER_IMMEDIATE("task-join", task_join);
+    REGISTER("task-done?", task_done);
+    REGISTER("r/o", read_only);
+    REGISTER("w/o", write_only);
+    REGISTER("r/w", read_write);
+    REGISTER("open-file", open_file);
+    REGISTER("create-file", create_file);
+    REGISTER("close-file", close_file);
+    REGISTER("file-size", file_size);
+    REGISTER("map-file", map_file);
+    REGISTER("unmap-file", unmap_file);
+    REGISTER("map-sequential", map_sequential);
+    REGISTER("map-willneed", map_willneed);
+    REGISTER("map-random", map_random);
+    REGISTER("read-file-async", read_file_async);
+    REGISTER("write-file-async", write_file_async);
+    REGISTER_IMMEDIATE("await", await);
     REGISTER("d>f", d_to_f);
     REGISTER("f>d", f_to_d);
     REGISTER("f+", fadd);
@@ -1078,12 +2414,34 @@ void forth_register_all_builtins(forth_t *forth) {
     REGISTER("f0>=", fgteqz);
     REGISTER("bye", bye);
     REGISTER("throw", throw);
+    REGISTER("abort", abort);
+    REGISTER("execute", execute);
+    REGISTER("catch", catch);
     REGISTER(">r", rpush);
     REGISTER("r@", rfetch);
     REGISTER("r>", rpop);
-    REGISTER(".\"", print);
+    REGISTER_IMMEDIATE(".\"", print);
+    REGISTER_IMMEDIATE("s\"", s_quote);
+    REGISTER_IMMEDIATE("(", paren);
+    REGISTER_IMMEDIATE("\\", backslash);
     REGISTER("cells", cells);
+    REGISTER("seed", seed);
+    REGISTER("random", random);
+    REGISTER("frandom", frandom);
+    REGISTER("random-fill", random_fill);
     REGISTER("allocate", allocate);
+    REGISTER(".stats", print_stats);
+    REGISTER("stats-reset", stats_reset);
+    REGISTER("profile-on", profile_on);
+    REGISTER("profile-off", profile_off);
+    REGISTER("profile-reset", profile_reset);
+    REGISTER("profile-report", profile_report);
+    REGISTER("profile-folded", profile_folded);
+    REGISTER("sample-on", sample_on);
+    REGISTER("sample-off", sample_off);
+    REGISTER("sample-reset", sample_reset);
+    REGISTER("sample-report", sample_report);
+    REGISTER("sample-folded", sample_folded);
 }
 
 #undef REGISTER
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "forth.h"
+
+// longer source text, like a whole file, isn't worth keeping around
+#define CACHE_MAX_TEXT 256
+
+// a word the compiled snippet uses and its version at the time
+typedef struct {
+    trie_node_t *node;
+    uint32_t version;
+} forth_snippet_ref_t;
+
+// source text given to forth_eval and the code it turned into, each word or
+// number in the text is one instruction
+typedef struct {
+    char *text;
+    size_t text_length;
+    uint64_t hash;
+    uint64_t used; // tick of the last hit, the smallest is evicted first
+
+    forth_instr_t *code;
+    size_t code_length;
+    size_t code_capacity;
+    forth_snippet_ref_t *refs;
+    size_t ref_count;
+    size_t ref_capacity;
+
+    int failed; // set while recording when the text can't be replayed
+} forth_snippet_t;
+
+typedef struct forth_cache_s {
+    forth_snippet_t *entries;
+    uint64_t tick;
+    uint64_t hits;
+    uint64_t misses;
+} forth_cache_t;
+
+// fnv-1a
+static uint64_t cache_hash(const char *text, size_t length) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t n = 0; n < length; n++) {
+        hash ^= (uint8_t) text[n];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static forth_cache_t *cache_create(void) {
+    forth_cache_t *cache = calloc(1, sizeof(forth_cache_t));
+    cache->entries = calloc(FORTH_EVAL_CACHE_SIZE, sizeof(forth_snippet_t));
+    return cache;
+}
+
+static void cache_free_snippet(forth_snippet_t *snippet) {
+    free(snippet->text);
+    free(snippet->code);
+    free(snippet->refs);
+    memset(snippet, 0, sizeof(*snippet));
+}
+
+static void cache_destroy(forth_cache_t *cache) {
+    if (cache == NULL) {
+        return;
+    }
+    for (size_t n = 0; n < FORTH_EVAL_CACHE_SIZE; n++) {
+        cache_free_snippet(&cache->entries[n]);
+    }
+    free(cache->entries);
+    free(cache);
+}
+
+static void cache_record(forth_snippet_t *snippet, forth_instr_t instr) {
+    if (snippet->code_length == snippet->code_capacity) {
+        snippet->code_capacity =
+            snippet->code_capacity ? snippet->code_capacity * 2 : 8;
+        snippet->code = realloc(snippet->code, sizeof(forth_instr_t) *
+                                                   snippet->code_capacity);
+    }
+    snippet->code[snippet->code_length++] = instr;
+}
+
+// the instruction that does what executing node at the prompt does
+static void cache_record_node(forth_snippet_t *snippet, trie_node_t *node) {
+    switch (node->node_type) {
+    case TRIE_NONE:
+        snippet->failed = 1;
+        return;
+    case TRIE_USERWORD:
+        cache_record(snippet, (forth_instr_t) {.op = OP_CALL, .node = node});
+        break;
+    case TRIE_BUILTIN:
+        cache_record(snippet, (forth_instr_t) {.op = OP_BUILTIN,
+                                               .node = node,
+                                               .fn = node->builtin_fn});
+        break;
+    case TRIE_FFI_FN:
+        cache_record(snippet, (forth_instr_t) {.op = OP_FFI_FN,
+                                               .node = node,
+                                               .fn = node->ffi_fn});
+        break;
+    case TRIE_VARIABLE:
+        cache_record(snippet,
+                     (forth_instr_t) {.op = OP_LITERAL, .literal = node->var});
+        break;
+    case TRIE_VALUE:
+        cache_record(snippet,
+                     (forth_instr_t) {.op = OP_FETCH, .literal = node->var});
+        break;
+    }
+
+    if (snippet->ref_count == snippet->ref_capacity) {
+        snippet->ref_capacity =
+            snippet->ref_capacity ? snippet->ref_capacity * 2 : 8;
+        snippet->refs =
+            realloc(snippet->refs,
+                    sizeof(forth_snippet_ref_t) * snippet->ref_capacity);
+    }
+    snippet->refs[snippet->ref_count++] =
+        (forth_snippet_ref_t) {node, node->version};
+}
+
+// the compiled snippet for text, NULL if there is none or a word it uses has
+// been redefined since
+static forth_snippet_t *cache_lookup(forth_cache_t *cache, const char *text,
+                                     size_t length, uint64_t hash) {
+    for (size_t n = 0; n < FORTH_EVAL_CACHE_SIZE; n++) {
+        forth_snippet_t *snippet = &cache->entries[n];
+        if (snippet->code == NULL || snippet->hash != hash ||
+            snippet->text_length != length ||
+            memcmp(snippet->text, text, length) != 0) {
+            continue;
+        }
+
+        for (size_t r = 0; r < snippet->ref_count; r++) {
+            forth_snippet_ref_t *ref = &snippet->refs[r];
+            if (ref->node->version != ref->version) {
+                cache_free_snippet(snippet);
+                cache->misses++;
+                return NULL;
+            }
+        }
+        snippet->used = ++cache->tick;
+        cache->hits++;
+        return snippet;
+    }
+
+    cache->misses++;
+    return NULL;
+}
+
+// keeps a recorded snippet, taking over its memory
+static void cache_insert(forth_cache_t *cache, forth_snippet_t *snippet,
+                         const char *text, size_t length, uint64_t hash) {
+    forth_snippet_t *slot = &cache->entries[0];
+    for (size_t n = 0; n < FORTH_EVAL_CACHE_SIZE && slot->code != NULL; n++) {
+        forth_snippet_t *entry = &cache->entries[n];
+        if (entry->code == NULL || entry->used < slot->used) {
+            slot = entry;
+        }
+    }
+    cache_free_snippet(slot);
+
+    cache_record(snippet, (forth_instr_t) {.op = OP_EXIT});
+    *slot = *snippet;
+    slot->text = malloc(length);
+    memcpy(slot->text, text, length);
+    slot->text_length = length;
+    slot->hash = hash;
+    slot->used = ++cache->tick;
+    memset(snippet, 0, sizeof(*snippet));
+}
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "forth.h"
+#include "trie.h"
+
+// forth_clone copies an idle instance. references are offsets into the
+// instance's own segments, so the heap and the stacks are copied as they
+// are. only compiled code points at dictionary nodes, and the execution
+// token table is rebuilt from the copied ones. regions point at the same
+// host memory as the parent's, and a map-file mapping stays until every
+// instance using it has unmapped it or been destroyed. everything is copied
+// up front, there is no copy on write. pictured output, tasks, the snippet
+// cache, stats, profilers, the par-do pool and async requests are left
+// out, the copy starts those afresh
+
+static void forth_share_region(forth_segment_t *region);
+
+// a parent node and the clone's copy of it
+typedef struct {
+    const trie_node_t *from;
+    trie_node_t *to;
+} clone_pair_t;
+
+typedef struct {
+    clone_pair_t *pairs; // open addressed on from
+    size_t mask;
+    size_t count;
+    trie_block_t **blocks;
+} clone_map_t;
+
+static size_t clone_hash(const void *node) {
+    return (size_t) (((uint64_t) (size_t) node >> 4) * 0x9e3779b97f4a7c15 >>
+                     32);
+}
+
+static void clone_put(clone_pair_t *pairs, size_t mask, clone_pair_t pair) {
+    size_t at = clone_hash(pair.from) & mask;
+    while (pairs[at].from != NULL) {
+        at = (at + 1) & mask;
+    }
+    pairs[at] = pair;
+}
+
+static void clone_add(clone_map_t *map, const trie_node_t *from,
+                      trie_node_t *to) {
+    // kept at most half full
+    if ((map->count + 1) * 2 > map->mask + 1) {
+        clone_pair_t *old = map->pairs;
+        size_t old_size = old != NULL ? map->mask + 1 : 0;
+        map->mask = map->mask ? map->mask * 2 + 1 : 2047;
+        map->pairs = calloc(map->mask + 1, sizeof(clone_pair_t));
+        for (size_t n = 0; n < old_size; n++) {
+            if (old[n].from != NULL) {
+                clone_put(map->pairs, map->mask, old[n]);
+            }
+        }
+        free(old);
+    }
+    clone_put(map->pairs, map->mask, (clone_pair_t) {.from = from, .to = to});
+    map->count++;
+}
+
+// the clone's copy of node, NULL for anything that isn't a parent node
+static trie_node_t *clone_node(const clone_map_t *map, const void *node) {
+    if (node == NULL) {
+        return NULL;
+    }
+    size_t at = clone_hash(node) & map->mask;
+    while (map->pairs[at].from != NULL) {
+        if (map->pairs[at].from == node) {
+            return map->pairs[at].to;
+        }
+        at = (at + 1) & map->mask;
+    }
+    return NULL;
+}
+
+// copies the shape of the dictionary in one walk, code is copied once every
+// node has a copy to point at. nodes are a kilobyte each, so they come from
+// blocks instead of one allocation apiece
+static trie_node_t *clone_trie(clone_map_t *map, const trie_node_t *from) {
+    trie_block_t *block = *map->blocks;
+    if (block == NULL || block->used == TRIE_BLOCK_NODES) {
+        block = malloc(sizeof(trie_block_t));
+        block->next = *map->blocks;
+        block->used = 0;
+        *map->blocks = block;
+    }
+
+    trie_node_t *to = &block->nodes[block->used++];
+    memcpy(to, from, sizeof(trie_node_t));
+    to->in_block = 1;
+    to->name = from->name != NULL ? strdup(from->name) : NULL;
+    if (from->userword_def != NULL) {
+        to->userword_def = malloc(from->userword_def_len + 1);
+        memcpy(to->userword_def, from->userword_def,
+               from->userword_def_len + 1);
+    }
+    clone_add(map, from, to);
+
+    for (size_t i = 0; i < ALPHABET_SIZE; i++) {
+        if (from->children[i] != NULL) {
+            to->children[i] = clone_trie(map, from->children[i]);
+        }
+    }
+    return to;
+}
+
+static forth_instr_t *clone_code(const clone_map_t *map,
+                                 const forth_instr_t *from, size_t length) {
+    forth_instr_t *to = malloc(sizeof(forth_instr_t) * length);
+    memcpy(to, from, sizeof(forth_instr_t) * length);
+
+    for (size_t i = 0; i < length; i++) {
+        switch (to[i].op) {
+        case OP_BUILTIN:
+        case OP_FFI_FN:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_INLINE:
+        case OP_SPAWN:
+            to[i].node = clone_node(map, to[i].node);
+            break;
+        case OP_PRINT:
+            to[i].string = strdup(to[i].string);
+            break;
+        default:
+            break;
+        }
+    }
+    return to;
+}
+
+static void clone_stack(forth_stack_t *to, const forth_stack_t *from) {
+    *to = stack_init(from->size);
+    memcpy(to->data, from->data, sizeof(forth_type_t) * (size_t) from->top);
+    to->top = from->top;
+}
+
+forth_t *forth_clone(const forth_t *parent) {
+    if (parent->return_stack.top != 0 || parent->source != NULL ||
+        parent->defining || parent->state->int64 ||
+        parent->suspended.ip != NULL || par_capture != NULL) {
+        return NULL;
+    }
+
+    forth_t *forth = aligned_alloc(_Alignof(forth_t), sizeof(forth_t));
+    memset(forth, 0, sizeof(forth_t));
+
+    // the heap is only copied as far as it was used, the pages past that
+    // are never touched
+    forth->heap_size = parent->heap_size;
+    forth->heap = malloc(parent->heap_size);
+    forth->next_address = parent->next_address;
+    memcpy(forth->heap, parent->heap, parent->next_address);
+
+    clone_map_t map = {.blocks = &forth->blocks};
+    forth->root = clone_trie(&map, parent->root);
+
+    for (trie_block_t *block = forth->blocks; block; block = block->next) {
+        for (size_t n = 0; n < block->used; n++) {
+            trie_node_t *node = &block->nodes[n];
+            if (node->node_type == TRIE_USERWORD) {
+                node->code = clone_code(&map, node->code, node->code_length);
+            }
+        }
+    }
+
+    // execution tokens keep their index, only the nodes they name move
+    forth->xt_count = parent->xt_count;
+    forth->xt_capacity = parent->xt_count;
+    forth->xts = malloc(sizeof(trie_node_t *) * (parent->xt_count + 1));
+    for (size_t n = 0; n < parent->xt_count; n++) {
+        forth->xts[n] = clone_node(&map, parent->xts[n]);
+    }
+
+    forth->region_count = parent->region_count;
+    forth->regions = malloc(sizeof(forth_segment_t) *
+                            (parent->region_count + 1));
+    for (size_t n = 0; n < parent->region_count; n++) {
+        forth->regions[n] = parent->regions[n];
+        forth_share_region(&forth->regions[n]);
+    }
+
+    clone_stack(&forth->data_stack, &parent->data_stack);
+    clone_stack(&forth->control_stack, &parent->control_stack);
+
+    forth->return_stack.size = parent->return_stack.size;
+    forth->return_stack.frames =
+        malloc(sizeof(forth_frame_t) * forth->return_stack.size);
+
+    forth->loop_size = parent->loop_size;
+    forth->loops = calloc(forth->loop_size, sizeof(forth_loop_t));
+    forth->loop_top = 1;
+
+    forth->state = (forth_type_t *) (forth->heap + ((uint8_t *) parent->state -
+                                                    parent->heap));
+    forth->base = (forth_type_t *) (forth->heap + ((uint8_t *) parent->base -
+                                                   parent->heap));
+    forth->sources = parent->sources;
+    forth->latest = clone_node(&map, parent->latest);
+    forth->latest_type = parent->latest_type;
+    forth->fuel = parent->fuel;
+    forth->hold_start = FORTH_HOLD_SIZE;
+    // the stacks or the heap can still hold interpreted strings
+    forth->transient = malloc(FORTH_TRANSIENT_SIZE);
+    memcpy(forth->transient, parent->transient, FORTH_TRANSIENT_SIZE);
+    forth->transient_next = parent->transient_next;
+    memcpy(forth->random, parent->random, sizeof(forth->random));
+
+    free(map.pairs);
+    return forth;
+}
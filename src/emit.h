@@ -0,0 +1,926 @@
+#pragma once
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "forth.h"
+
+// meili --emit-c: translates the colon definitions of the loaded files into
+// c functions that work on forth_t's stacks. inside straight-line code the
+// stack items live in c locals and only go through the data stack at
+// branches, calls and the end of a word. the generated registration
+// function looks up the builtins, variables and values the words use by
+// name and adds every word as an ffi function in place of its definition.
+// words that need the interpreter (par-do, tasks, await, execution tokens
+// or addresses that aren't variables) and words that call them are left
+// out and keep running as they are
+
+// a builtin translated in place. a shuffle lists the inputs it leaves by
+// number, 0 being the deepest. otherwise expr is the one cell it leaves or
+// stmt what it does. with verb the top input is a cell address, $p is its
+// host address and a bad one throws the way the builtin does
+typedef struct {
+    const char *name;
+    int in;
+    const char *shuffle;
+    const char *expr;
+    const char *stmt;
+    const char *verb;
+} emit_prim_t;
+
+static const emit_prim_t emit_prims[] = {
+    {.name = "dup", .in = 1, .shuffle = "00"},
+    {.name = "drop", .in = 1, .shuffle = ""},
+    {.name = "swap", .in = 2, .shuffle = "10"},
+    {.name = "over", .in = 2, .shuffle = "010"},
+    {.name = "rot", .in = 3, .shuffle = "120"},
+    {.name = "2dup", .in = 2, .shuffle = "0101"},
+    {.name = "2drop", .in = 2, .shuffle = ""},
+    {.name = "2swap", .in = 4, .shuffle = "2301"},
+    {.name = "2over", .in = 4, .shuffle = "012301"},
+    {.name = "+",
+     .in = 2,
+     .expr = "$0.tag == FORTH_REF ? forth_ref($0.ref + $1.ref) : "
+             "forth_i64($0.int64 + $1.int64)"},
+    {.name = "-", .in = 2, .expr = "forth_i64($0.int64 - $1.int64)"},
+    {.name = "*", .in = 2, .expr = "forth_i64($0.int64 * $1.int64)"},
+    {.name = "1+", .in = 1, .expr = "forth_i64($0.int64 + 1)"},
+    {.name = "1-", .in = 1, .expr = "forth_i64($0.int64 - 1)"},
+    {.name = "2+", .in = 1, .expr = "forth_i64($0.int64 + 2)"},
+    {.name = "2-", .in = 1, .expr = "forth_i64($0.int64 - 2)"},
+    {.name = "negate", .in = 1, .expr = "forth_i64(-$0.int64)"},
+    {.name = "abs",
+     .in = 1,
+     .expr = "$0.int64 > 0 ? $0 : forth_i64(-$0.int64)"},
+    {.name = "max", .in = 2, .expr = "$0.int64 > $1.int64 ? $0 : $1"},
+    {.name = "min", .in = 2, .expr = "$0.int64 < $1.int64 ? $0 : $1"},
+    {.name = "and", .in = 2, .expr = "forth_i64($0.int64 & $1.int64)"},
+    {.name = "or", .in = 2, .expr = "forth_i64($0.int64 | $1.int64)"},
+    {.name = "xor", .in = 2, .expr = "forth_i64($0.int64 ^ $1.int64)"},
+    {.name = "lshift", .in = 2, .expr = "forth_i64($0.int64 << $1.int64)"},
+    {.name = "rshift", .in = 2, .expr = "forth_i64($0.int64 >> $1.int64)"},
+    {.name = "<", .in = 2, .expr = "forth_i64($0.int64 < $1.int64 ? -1 : 0)"},
+    {.name = "=", .in = 2, .expr = "forth_i64($0.int64 == $1.int64 ? -1 : 0)"},
+    {.name = ">", .in = 2, .expr = "forth_i64($0.int64 > $1.int64 ? -1 : 0)"},
+    {.name = ">=", .in = 2, .expr = "forth_i64($0.int64 >= $1.int64 ? -1 : 0)"},
+    {.name = "<=", .in = 2, .expr = "forth_i64($0.int64 <= $1.int64 ? -1 : 0)"},
+    {.name = "0<", .in = 1, .expr = "forth_i64($0.int64 < 0 ? -1 : 0)"},
+    {.name = "0=", .in = 1, .expr = "forth_i64($0.int64 == 0 ? -1 : 0)"},
+    {.name = "0>", .in = 1, .expr = "forth_i64($0.int64 > 0 ? -1 : 0)"},
+    {.name = "not", .in = 1, .expr = "forth_i64($0.int64 == 0 ? -1 : 0)"},
+    {.name = "cells",
+     .in = 1,
+     .expr = "(forth_type_t) {.tag = $0.tag, "
+             ".int64 = $0.int64 * (int64_t) sizeof(forth_type_t)}"},
+    {.name = "f+", .in = 2, .expr = "forth_f64($0.float64 + $1.float64)"},
+    {.name = "f-", .in = 2, .expr = "forth_f64($0.float64 - $1.float64)"},
+    {.name = "f*", .in = 2, .expr = "forth_f64($0.float64 * $1.float64)"},
+    {.name = "f/", .in = 2, .expr = "forth_f64($0.float64 / $1.float64)"},
+    {.name = "fnegate", .in = 1, .expr = "forth_f64(-$0.float64)"},
+    {.name = "f<",
+     .in = 2,
+     .expr = "forth_i64($0.float64 < $1.float64 ? -1 : 0)"},
+    {.name = "@",
+     .in = 1,
+     .expr = "*$p",
+     .verb = "loading from"},
+    {.name = "!",
+     .in = 2,
+     .stmt = "*$p = $0",
+     .verb = "storing to"},
+    {.name = ">r",
+     .in = 1,
+     .stmt = "stack_push(&forth->control_stack, $0)"},
+    {.name = "r>", .in = 0, .expr = "stack_pop(&forth->control_stack)"},
+    {.name = "r@", .in = 0, .expr = "stack_peek(&forth->control_stack)"},
+};
+
+typedef struct {
+    trie_node_t **nodes;
+    size_t count;
+    size_t capacity;
+} emit_list_t;
+
+typedef struct {
+    emit_list_t words;     // every user word, in name order
+    const char **reasons;  // why a word stays interpreted, NULL if it doesn't
+    emit_list_t cells;     // variables, constants of an address and values
+    emit_list_t variables; // the ones of those the translation uses
+    emit_list_t values;
+    emit_list_t functions; // builtins and ffi functions called
+    trie_node_t *type;     // ." prints through type
+    const char **strings;  // what ." prints, each one a region
+    size_t string_count;
+
+    // the word being translated
+    FILE *out;
+    int *stack; // locals standing for the top of the data stack
+    size_t depth;
+    size_t stack_capacity;
+    int locals;
+} emit_t;
+
+static void emit_add(emit_list_t *list, trie_node_t *node) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->nodes =
+            realloc(list->nodes, sizeof(trie_node_t *) * list->capacity);
+    }
+    list->nodes[list->count++] = node;
+}
+
+// the index of node in list, adding it when add is set, -1 if it's missing
+static int64_t emit_index(emit_list_t *list, trie_node_t *node, int add) {
+    for (size_t n = 0; n < list->count; n++) {
+        if (list->nodes[n] == node) {
+            return (int64_t) n;
+        }
+    }
+    if (!add) {
+        return -1;
+    }
+    emit_add(list, node);
+    return (int64_t) list->count - 1;
+}
+
+static void emit_collect(emit_t *e, trie_node_t *node) {
+    if (node->node_type == TRIE_USERWORD) {
+        emit_add(&e->words, node);
+    } else if (node->node_type == TRIE_VARIABLE &&
+               node->var.tag == FORTH_REF) {
+        emit_add(&e->cells, node);
+    } else if (node->node_type == TRIE_VALUE) {
+        emit_add(&e->cells, node);
+    } else if (node->node_type == TRIE_BUILTIN &&
+               strequal(node->name, "type")) {
+        e->type = node;
+    }
+    for (size_t i = 0; i < ALPHABET_SIZE; i++) {
+        if (node->children[i] != NULL) {
+            emit_collect(e, node->children[i]);
+        }
+    }
+}
+
+// the variable or value of that type whose cell is at ref
+static trie_node_t *emit_cell_owner(const emit_t *e, size_t ref,
+                                    enum TRIE_NODE_TYPE type) {
+    for (size_t n = 0; n < e->cells.count; n++) {
+        trie_node_t *node = e->cells.nodes[n];
+        if (node->node_type == type && node->var.ref == ref) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+static const emit_prim_t *emit_prim(const trie_node_t *node) {
+    if (node->node_type != TRIE_BUILTIN) {
+        return NULL;
+    }
+    for (size_t n = 0; n < sizeof(emit_prims) / sizeof(emit_prims[0]); n++) {
+        if (strequal(node->name, emit_prims[n].name)) {
+            return &emit_prims[n];
+        }
+    }
+    return NULL;
+}
+
+// why word can't be translated on its own account, NULL if it can
+static const char *emit_check(emit_t *e, const trie_node_t *word) {
+    int loops = 0;
+    for (size_t i = 0; i < word->code_length; i++) {
+        const forth_instr_t *ip = &word->code[i];
+        switch (ip->op) {
+        case OP_LITERAL:
+            if (ip->literal.tag == FORTH_REF &&
+                emit_cell_owner(e, ip->literal.ref, TRIE_VARIABLE) == NULL) {
+                return "uses an address or execution token that isn't a "
+                       "variable";
+            }
+            break;
+        case OP_FETCH:
+        case OP_STORE:
+            if (emit_cell_owner(e, ip->literal.ref, TRIE_VALUE) == NULL) {
+                return "uses a value that is gone";
+            }
+            break;
+        case OP_CALL:
+        case OP_TAIL_CALL:
+            if (ip->node->node_type != TRIE_USERWORD &&
+                ip->node->node_type != TRIE_BUILTIN &&
+                ip->node->node_type != TRIE_FFI_FN) {
+                return "calls a word that was redefined as data";
+            }
+            break;
+        case OP_DO:
+        case OP_QDO:
+            loops++;
+            break;
+        case OP_LOOP:
+        case OP_PLUS_LOOP:
+        case OP_MINUS_LOOP:
+            loops--;
+            break;
+        case OP_I:
+        case OP_J:
+            if (loops < (ip->op == OP_I ? 1 : 2)) {
+                return "uses the index of a loop in its caller";
+            }
+            break;
+        case OP_PAR_DO:
+        case OP_PAR_LOOP:
+        case OP_PAR_SUM:
+        case OP_PAR_MIN:
+        case OP_PAR_MAX:
+            return "uses par-do";
+        case OP_PAUSE:
+        case OP_SPAWN:
+        case OP_JOIN:
+            return "uses tasks";
+        case OP_AWAIT:
+            return "uses await";
+        case OP_PARAM:
+            return "uses a prepared program's parameters";
+        case OP_PRINT:
+            if (e->type == NULL) {
+                return "prints with .\" and type was redefined";
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    return NULL;
+}
+
+static int emit_translated(emit_t *e, const trie_node_t *node) {
+    int64_t n = emit_index(&e->words, (trie_node_t *) node, 0);
+    return n >= 0 && e->reasons[n] == NULL;
+}
+
+// a word calling one that stays interpreted stays interpreted too
+static void emit_decide(emit_t *e) {
+    e->reasons = calloc(e->words.count, sizeof(const char *));
+    for (size_t n = 0; n < e->words.count; n++) {
+        e->reasons[n] = emit_check(e, e->words.nodes[n]);
+    }
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (size_t n = 0; n < e->words.count; n++) {
+            const trie_node_t *word = e->words.nodes[n];
+            for (size_t i = 0; i < word->code_length && !e->reasons[n]; i++) {
+                const forth_instr_t *ip = &word->code[i];
+                if ((ip->op == OP_CALL || ip->op == OP_TAIL_CALL) &&
+                    ip->node->node_type == TRIE_USERWORD &&
+                    !emit_translated(e, ip->node)) {
+                    e->reasons[n] = "calls a word that stays interpreted";
+                    changed = 1;
+                }
+            }
+        }
+    }
+}
+
+// c identifiers keep what they can of forth names and file names
+static void emit_identifier(FILE *out, const char *text, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        char c = text[i];
+        int ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                 (c >= '0' && c <= '9');
+        fputc(ok ? c : '_', out);
+    }
+}
+
+static void emit_word_name(FILE *out, const emit_t *e,
+                           const trie_node_t *word) {
+    fprintf(out, "w%" PRId64 "_", emit_index((emit_list_t *) &e->words,
+                                               (trie_node_t *) word, 0));
+    emit_identifier(out, word->name, strlen(word->name));
+}
+
+static void emit_string(FILE *out, const char *text, size_t length) {
+    fputc('"', out);
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char) text[i];
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 32 || c >= 127) {
+            fprintf(out, "\\%03o", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+// locals standing for stack items are only ever assigned once, so shuffles
+// just rearrange which ones stand where
+static void emit_push(emit_t *e, int local) {
+    if (e->depth == e->stack_capacity) {
+        e->stack_capacity = e->stack_capacity ? e->stack_capacity * 2 : 16;
+        e->stack = realloc(e->stack, sizeof(int) * e->stack_capacity);
+    }
+    e->stack[e->depth++] = local;
+}
+
+static int emit_local(emit_t *e, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+// declares the next local as the value of an expression
+static int emit_local(emit_t *e, const char *fmt, ...) {
+    int local = e->locals++;
+    fprintf(e->out, "    forth_type_t t%d = ", local);
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(e->out, fmt, args);
+    va_end(args);
+    fprintf(e->out, ";\n");
+    return local;
+}
+
+// takes the top n items into in, deepest first, popping what the locals
+// don't already hold
+static void emit_take(emit_t *e, int n, int *in) {
+    int held = (int) e->depth < n ? (int) e->depth : n;
+    for (int k = n - held - 1; k >= 0; k--) {
+        in[k] = emit_local(e, "gen_pop(forth)");
+    }
+    for (int k = 0; k < held; k++) {
+        in[n - held + k] = e->stack[e->depth - held + k];
+    }
+    e->depth -= held;
+}
+
+static void emit_flush(emit_t *e) {
+    for (size_t n = 0; n < e->depth; n++) {
+        fprintf(e->out, "    gen_push(forth, t%d);\n", e->stack[n]);
+    }
+    e->depth = 0;
+}
+
+// writes a template with $n replaced by the local for input n and $p by
+// the host address local
+static void emit_template(emit_t *e, const char *text, const int *in,
+                          int addr) {
+    for (const char *c = text; *c != '\0'; c++) {
+        if (*c == '$' && c[1] >= '0' && c[1] <= '9') {
+            fprintf(e->out, "t%d", in[*++c - '0']);
+        } else if (*c == '$' && c[1] == 'p') {
+            fprintf(e->out, "p%d", addr);
+            c++;
+        } else {
+            fputc(*c, e->out);
+        }
+    }
+}
+
+static void emit_primitive(emit_t *e, const emit_prim_t *prim) {
+    int in[4];
+    emit_take(e, prim->in, in);
+
+    int addr = -1;
+    if (prim->verb != NULL) {
+        addr = e->locals++;
+        int ref = in[prim->in - 1];
+        fprintf(e->out,
+                "    forth_type_t *p%d = t%d.tag == FORTH_REF\n"
+                "        ? forth_addr(forth, t%d.ref, sizeof(forth_type_t))\n"
+                "        : NULL;\n    if (p%d == NULL) {\n",
+                addr, ref, ref, addr);
+
+        // failing leaves the stack as the builtin would, with only the top
+        // input taken
+        for (size_t n = 0; n < e->depth; n++) {
+            fprintf(e->out, "        gen_push(forth, t%d);\n", e->stack[n]);
+        }
+        for (int k = 0; k + 1 < prim->in; k++) {
+            fprintf(e->out, "        gen_push(forth, t%d);\n", in[k]);
+        }
+        fprintf(e->out,
+                "        forth_throw(forth, FORTH_THROW_INVALID_ADDRESS,\n"
+                "                    t%d.tag == FORTH_REF ? \"%s invalid "
+                "address\"\n"
+                "                                         : \"%s "
+                "non-reference type\");\n"
+                "        goto done;\n    }\n",
+                ref, prim->verb, prim->verb);
+    }
+
+    if (prim->shuffle != NULL) {
+        for (int k = 0; k < prim->in; k++) {
+            if (strchr(prim->shuffle, '0' + k) == NULL) {
+                fprintf(e->out, "    (void) t%d;\n", in[k]);
+            }
+        }
+        for (const char *c = prim->shuffle; *c != '\0'; c++) {
+            emit_push(e, in[*c - '0']);
+        }
+    } else if (prim->expr != NULL) {
+        int local = e->locals++;
+        fprintf(e->out, "    forth_type_t t%d = ", local);
+        emit_template(e, prim->expr, in, addr);
+        fprintf(e->out, ";\n");
+        emit_push(e, local);
+    } else {
+        fprintf(e->out, "    ");
+        emit_template(e, prim->stmt, in, addr);
+        fprintf(e->out, ";\n");
+    }
+}
+
+// where the interpreter would spend fuel, which is also where a loop that
+// only moves stack items around notices it ran off the stack. a c function
+// can't be resumed halfway, so running out throws instead of suspending
+static void emit_spend_fuel(emit_t *e) {
+    fprintf(e->out, "    if (--fuel < 0) {\n        forth_throw(forth, "
+                    "FORTH_THROW_OUT_OF_FUEL, \"out of fuel\");\n"
+                    "        goto done;\n    }\n"
+                    "    if (gen_failed(forth)) {\n        goto done;\n"
+                    "    }\n");
+}
+
+// calls a builtin, ffi function or translated word with the stack flushed
+static void emit_call(emit_t *e, trie_node_t *node) {
+    emit_flush(e);
+    fprintf(e->out, "    forth->fuel = fuel;\n    ");
+    if (node->node_type == TRIE_USERWORD) {
+        emit_word_name(e->out, e, node);
+    } else {
+        fprintf(e->out, "f%" PRId64, emit_index(&e->functions, node, 1));
+    }
+    fprintf(e->out, "(forth);\n    fuel = forth->fuel;\n"
+                    "    if (gen_failed(forth)) {\n        goto done;\n"
+                    "    }\n");
+}
+
+static void emit_literal(emit_t *e, forth_type_t val) {
+    int local;
+    if (val.tag == FORTH_I64 && val.int64 == INT64_MIN) {
+        local = emit_local(e, "forth_i64(INT64_MIN)");
+    } else if (val.tag == FORTH_I64) {
+        local = emit_local(e, "forth_i64(%" PRId64 ")", val.int64);
+    } else if (val.tag == FORTH_F64 && isnan(val.float64)) {
+        local = emit_local(e, "forth_f64(NAN)");
+    } else if (val.tag == FORTH_F64 && isinf(val.float64)) {
+        local = emit_local(e, "forth_f64(%sINFINITY)",
+                           val.float64 < 0 ? "-" : "");
+    } else if (val.tag == FORTH_F64) {
+        local = emit_local(e, "forth_f64(%a)", val.float64);
+    } else {
+        trie_node_t *owner = emit_cell_owner(e, val.ref, TRIE_VARIABLE);
+        local = emit_local(e, "forth_ref(v%" PRId64 ")",
+                           emit_index(&e->variables, owner, 1));
+    }
+    emit_push(e, local);
+}
+
+static void emit_word(emit_t *e, trie_node_t *word) {
+    size_t length = word->code_length;
+    const forth_instr_t *code = word->code;
+
+    // do loops open at each instruction, their index and limit are locals
+    // named after the instruction of the do
+    size_t *loops = malloc(sizeof(size_t) * (length + 1));
+    size_t loop_depth = 0;
+
+    // instructions something jumps to, where the stack has to be flushed
+    char *target = calloc(length + 1, 1);
+    for (size_t i = 0; i < length; i++) {
+        switch (code[i].op) {
+        case OP_DO:
+            loops[loop_depth++] = i;
+            break;
+        case OP_QDO:
+            loops[loop_depth++] = i;
+            target[(int64_t) i + code[i].offset] = 1;
+            break;
+        case OP_LEAVE: {
+            size_t d = loops[loop_depth - 1];
+            target[(int64_t) d + code[d].offset] = 1;
+            break;
+        }
+        case OP_LOOP:
+        case OP_PLUS_LOOP:
+        case OP_MINUS_LOOP:
+            loop_depth--;
+            // fall through
+        case OP_BRANCH:
+        case OP_0BRANCH:
+            target[(int64_t) i + code[i].offset] = 1;
+            break;
+        default:
+            break;
+        }
+    }
+
+    char *body = NULL;
+    size_t body_length = 0;
+    FILE *out = e->out;
+    e->out = open_memstream(&body, &body_length);
+    e->depth = 0;
+    e->locals = 0;
+
+    size_t *loop_ids = NULL;
+    size_t loop_count = 0;
+    int loops_back = 0; // to the start, for a tail call to itself
+
+    for (size_t i = 0; i < length; i++) {
+        const forth_instr_t *ip = &code[i];
+        if (target[i]) {
+            emit_flush(e);
+            fprintf(e->out, "L%zu:;\n", i);
+        }
+
+        int in[2];
+        size_t to = (size_t) ((int64_t) i + ip->offset);
+        switch (ip->op) {
+        case OP_LITERAL:
+            emit_literal(e, ip->literal);
+            break;
+        case OP_FETCH: {
+            trie_node_t *owner =
+                emit_cell_owner(e, ip->literal.ref, TRIE_VALUE);
+            emit_push(e, emit_local(e, "*gen_cell(forth, val%" PRId64 ")",
+                                    emit_index(&e->values, owner, 1)));
+            break;
+        }
+        case OP_STORE: {
+            trie_node_t *owner =
+                emit_cell_owner(e, ip->literal.ref, TRIE_VALUE);
+            emit_take(e, 1, in);
+            fprintf(e->out, "    *gen_cell(forth, val%" PRId64 ") = t%d;\n",
+                    emit_index(&e->values, owner, 1), in[0]);
+            break;
+        }
+        case OP_BUILTIN:
+        case OP_FFI_FN: {
+            const emit_prim_t *prim = emit_prim(ip->node);
+            if (prim != NULL) {
+                emit_primitive(e, prim);
+            } else {
+                emit_call(e, ip->node);
+            }
+            break;
+        }
+        case OP_CALL:
+        case OP_TAIL_CALL:
+            if (ip->op == OP_TAIL_CALL && ip->node == word) {
+                // a loop rather than c recursion
+                emit_flush(e);
+                emit_spend_fuel(e);
+                fprintf(e->out, "    goto start;\n");
+                loops_back = 1;
+                break;
+            }
+            if (ip->node->node_type == TRIE_USERWORD) {
+                emit_flush(e);
+                emit_spend_fuel(e);
+            }
+            emit_call(e, ip->node);
+            if (ip->op == OP_TAIL_CALL) {
+                fprintf(e->out, "    goto done;\n");
+            }
+            break;
+        case OP_INLINE:
+            // translated words are bound when they are translated, so the
+            // guard against redefinition never fails
+            break;
+        case OP_EXIT:
+            emit_flush(e);
+            fprintf(e->out, "    goto done;\n");
+            break;
+        case OP_BRANCH:
+            emit_flush(e);
+            if (ip->offset <= 0) {
+                emit_spend_fuel(e);
+            }
+            fprintf(e->out, "    goto L%zu;\n", to);
+            break;
+        case OP_0BRANCH:
+            emit_take(e, 1, in);
+            emit_flush(e);
+            if (ip->offset <= 0) {
+                emit_spend_fuel(e);
+            }
+            fprintf(e->out, "    if (t%d.int64 == 0) {\n        goto L%zu;\n"
+                            "    }\n",
+                    in[0], to);
+            break;
+        case OP_DO:
+        case OP_QDO:
+            emit_take(e, 2, in);
+            emit_flush(e);
+            if (ip->op == OP_QDO) {
+                fprintf(e->out,
+                        "    if (t%d.int64 == t%d.int64) {\n"
+                        "        goto L%zu;\n    }\n",
+                        in[1], in[0], to);
+            }
+            fprintf(e->out, "    l%zu = t%d.int64;\n    i%zu = t%d.int64;\n",
+                    i, in[0], i, in[1]);
+            loops[loop_depth++] = i;
+            loop_ids = realloc(loop_ids, sizeof(size_t) * (loop_count + 1));
+            loop_ids[loop_count++] = i;
+            break;
+        case OP_LOOP: {
+            size_t d = loops[--loop_depth];
+            emit_flush(e);
+            emit_spend_fuel(e);
+            fprintf(e->out, "    if (++i%zu < l%zu) {\n        goto L%zu;\n"
+                            "    }\n",
+                    d, d, to);
+            break;
+        }
+        case OP_PLUS_LOOP:
+        case OP_MINUS_LOOP: {
+            size_t d = loops[--loop_depth];
+            int up = ip->op == OP_PLUS_LOOP;
+            emit_take(e, 1, in);
+            emit_flush(e);
+            emit_spend_fuel(e);
+            fprintf(e->out,
+                    "    i%zu %c= t%d.int64;\n"
+                    "    if ((t%d.int64 > 0 && i%zu %c l%zu) ||\n"
+                    "        (t%d.int64 < 0 && i%zu %c l%zu)) {\n"
+                    "        goto L%zu;\n    }\n",
+                    d, up ? '+' : '-', in[0], in[0], d, up ? '<' : '>', d,
+                    in[0], d, up ? '>' : '<', d, to);
+            break;
+        }
+        case OP_LEAVE: {
+            size_t d = loops[loop_depth - 1];
+            emit_flush(e);
+            fprintf(e->out, "    goto L%zu;\n",
+                    (size_t) ((int64_t) d + code[d].offset));
+            break;
+        }
+        case OP_UNLOOP:
+            break;
+        case OP_I:
+        case OP_J: {
+            size_t d = loops[loop_depth - (ip->op == OP_I ? 1 : 2)];
+            emit_push(e, emit_local(e, "forth_i64(i%zu)", d));
+            break;
+        }
+        case OP_PRINT: {
+            emit_flush(e);
+            e->strings = realloc(e->strings, sizeof(const char *) *
+                                                 (e->string_count + 1));
+            e->strings[e->string_count] = ip->string;
+            fprintf(e->out,
+                    "    gen_push(forth, forth_ref(s%zu));\n"
+                    "    gen_push(forth, forth_i64(%zu));\n",
+                    e->string_count++, strlen(ip->string));
+            emit_call(e, e->type);
+            break;
+        }
+        default:
+            // ruled out by emit_check
+            break;
+        }
+    }
+    fclose(e->out);
+    e->out = out;
+
+    fprintf(out, "static void ");
+    emit_word_name(out, e, word);
+    fprintf(out, "(forth_t *forth) {\n    int64_t fuel = forth->fuel;\n");
+    for (size_t n = 0; n < loop_count; n++) {
+        fprintf(out, "    int64_t i%zu = 0, l%zu = 0;\n", loop_ids[n],
+                loop_ids[n]);
+    }
+    fprintf(out, "    if (++gen_depth > FORTH_GEN_MAX_DEPTH) {\n"
+                 "        forth_throw(forth, FORTH_THROW_RSTACK_OVERFLOW,\n"
+                 "                    \"return stack overflow\");\n"
+                 "        goto done;\n    }\n");
+    if (loops_back) {
+        fprintf(out, "start:;\n");
+    }
+    fwrite(body, 1, body_length, out);
+    fprintf(out, "done:\n    gen_depth--;\n    forth->fuel = fuel;\n}\n\n");
+
+    free(body);
+    free(loops);
+    free(loop_ids);
+    free(target);
+}
+
+static const char emit_prelude[] =
+    "#include <math.h>\n"
+    "#include <stdint.h>\n"
+    "\n"
+    "#include \"forth.h\"\n"
+    "\n"
+    "#ifndef FORTH_GEN_MAX_DEPTH\n"
+    "// calls between translated words nested deeper than this throw a\n"
+    "// return stack overflow instead of running out of c stack\n"
+    "#define FORTH_GEN_MAX_DEPTH 10000\n"
+    "#endif\n"
+    "\n"
+    "// the same as stack_pop and stack_push, where the compiler can see "
+    "them\n"
+    "static inline forth_type_t gen_pop(forth_t *forth) {\n"
+    "    forth_stack_t *stack = &forth->data_stack;\n"
+    "    if (stack->top <= 0) {\n"
+    "        stack->fault = FORTH_THROW_STACK_UNDERFLOW;\n"
+    "        return forth_i64(0);\n"
+    "    }\n"
+    "    return stack->data[--stack->top];\n"
+    "}\n"
+    "\n"
+    "static inline void gen_push(forth_t *forth, forth_type_t val) {\n"
+    "    forth_stack_t *stack = &forth->data_stack;\n"
+    "    if ((stack->top + 1) * (int64_t) sizeof(forth_type_t) > "
+    "stack->size) {\n"
+    "        stack->fault = FORTH_THROW_STACK_OVERFLOW;\n"
+    "        return;\n"
+    "    }\n"
+    "    stack->data[stack->top++] = val;\n"
+    "}\n"
+    "\n"
+    "static inline int gen_failed(const forth_t *forth) {\n"
+    "    return (forth->data_stack.fault | forth->control_stack.fault |\n"
+    "            forth->error) != 0;\n"
+    "}\n"
+    "\n"
+    "// a heap cell, values stay where they are for as long as the "
+    "instance\n"
+    "static inline forth_type_t *gen_cell(forth_t *forth, size_t ref) {\n"
+    "    return (forth_type_t *) (forth->heap + ref);\n"
+    "}\n"
+    "\n"
+    "// the reference a variable leaves\n"
+    "static inline int gen_variable(forth_t *forth, const char *name,\n"
+    "                               size_t *ref) {\n"
+    "    if (forth_eval(forth, name) != 0 || forth->data_stack.top == 0) "
+    "{\n"
+    "        return 0;\n"
+    "    }\n"
+    "    forth_type_t val = gen_pop(forth);\n"
+    "    *ref = val.ref;\n"
+    "    return val.tag == FORTH_REF;\n"
+    "}\n"
+    "\n"
+    "static inline int gen_value(forth_t *forth, const char *name, size_t "
+    "*ref) {\n"
+    "    forth_type_t *cell = forth_get_value(forth, name);\n"
+    "    *ref = cell != NULL ? (size_t) ((uint8_t *) cell - forth->heap) : "
+    "0;\n"
+    "    return cell != NULL;\n"
+    "}\n"
+    "\n"
+    "static inline int gen_missing(forth_t *forth, const char *name) {\n"
+    "    forth_throw(forth, FORTH_THROW_UNDEFINED_WORD, \"word '%s' "
+    "undefined\",\n"
+    "                name);\n"
+    "    return FORTH_THROW_UNDEFINED_WORD;\n"
+    "}\n"
+    "\n";
+
+// writes the translation of every user word in forth as c, with a
+// registration function named after source
+static void forth_emit_c(forth_t *forth, const char *source, FILE *out) {
+    emit_t e = {0};
+    emit_collect(&e, forth->root);
+    emit_decide(&e);
+
+    // the registration function is named after the file without its
+    // directory and extension
+    const char *base = strrchr(source, '/');
+    base = base != NULL ? base + 1 : source;
+    size_t stem = strcspn(base, ".");
+
+    fprintf(out, "// generated by meili --emit-c from %s\n", base);
+    size_t translated = 0;
+    for (size_t n = 0; n < e.words.count; n++) {
+        if (e.reasons[n] != NULL) {
+            fprintf(out, "// '%s' is left to the interpreter, it %s\n",
+                    e.words.nodes[n]->name, e.reasons[n]);
+            fprintf(stderr, "emit-c: '%s' %s\n", e.words.nodes[n]->name,
+                    e.reasons[n]);
+        } else {
+            translated++;
+        }
+    }
+    fprintf(out, "\n%s", emit_prelude);
+    if (translated > 0) {
+        fprintf(out, "static _Thread_local int gen_depth;\n\n");
+    }
+
+    for (size_t n = 0; n < e.words.count; n++) {
+        if (e.reasons[n] == NULL) {
+            fprintf(out, "static void ");
+            emit_word_name(out, &e, e.words.nodes[n]);
+            fprintf(out, "(forth_t *forth);\n");
+        }
+    }
+
+    // bodies go out first so the functions and cells they use are known
+    char *bodies = NULL;
+    size_t bodies_length = 0;
+    FILE *words = open_memstream(&bodies, &bodies_length);
+    e.out = words;
+    for (size_t n = 0; n < e.words.count; n++) {
+        if (e.reasons[n] == NULL) {
+            emit_word(&e, e.words.nodes[n]);
+        }
+    }
+    fclose(words);
+
+    fprintf(out, "\n");
+    for (size_t n = 0; n < e.functions.count; n++) {
+        fprintf(out, "static forth_ffi_fn_ptr f%zu; // %s\n", n,
+                e.functions.nodes[n]->name);
+    }
+    for (size_t n = 0; n < e.variables.count; n++) {
+        fprintf(out, "static size_t v%zu; // %s\n", n,
+                e.variables.nodes[n]->name);
+    }
+    for (size_t n = 0; n < e.values.count; n++) {
+        fprintf(out, "static size_t val%zu; // %s\n", n,
+                e.values.nodes[n]->name);
+    }
+    for (size_t n = 0; n < e.string_count; n++) {
+        fprintf(out, "static size_t s%zu;\nstatic char text%zu[] = ", n, n);
+        emit_string(out, e.strings[n], strlen(e.strings[n]));
+        fprintf(out, ";\n");
+    }
+    fprintf(out, "\n");
+    fwrite(bodies, 1, bodies_length, out);
+    free(bodies);
+
+    fprintf(out,
+            "// adds the translated words to forth in place of their "
+            "definitions.\n// the cells and strings words use are looked "
+            "up in this instance, so\n// they are only for the last "
+            "instance they were added to and its clones\n"
+            "int forth_register_");
+    emit_identifier(out, base, stem);
+    fprintf(out, "(forth_t *forth) {\n");
+    if (translated == 0) {
+        fprintf(out, "    (void) forth;\n");
+    }
+    for (size_t n = 0; n < e.functions.count; n++) {
+        fprintf(out, "    if ((f%zu = forth_get_function(forth, ", n);
+        emit_string(out, e.functions.nodes[n]->name,
+                    strlen(e.functions.nodes[n]->name));
+        fprintf(out, ")) == NULL) {\n        return gen_missing(forth, ");
+        emit_string(out, e.functions.nodes[n]->name,
+                    strlen(e.functions.nodes[n]->name));
+        fprintf(out, ");\n    }\n");
+    }
+    for (size_t n = 0; n < e.variables.count; n++) {
+        fprintf(out, "    if (!gen_variable(forth, ");
+        emit_string(out, e.variables.nodes[n]->name,
+                    strlen(e.variables.nodes[n]->name));
+        fprintf(out, ", &v%zu)) {\n        return gen_missing(forth, ", n);
+        emit_string(out, e.variables.nodes[n]->name,
+                    strlen(e.variables.nodes[n]->name));
+        fprintf(out, ");\n    }\n");
+    }
+    for (size_t n = 0; n < e.values.count; n++) {
+        fprintf(out, "    if (!gen_value(forth, ");
+        emit_string(out, e.values.nodes[n]->name,
+                    strlen(e.values.nodes[n]->name));
+        fprintf(out, ", &val%zu)) {\n        return gen_missing(forth, ", n);
+        emit_string(out, e.values.nodes[n]->name,
+                    strlen(e.values.nodes[n]->name));
+        fprintf(out, ");\n    }\n");
+    }
+    for (size_t n = 0; n < e.string_count; n++) {
+        fprintf(out,
+                "    s%zu = forth_add_region(forth, text%zu, "
+                "sizeof(text%zu) - 1).ref;\n",
+                n, n, n);
+    }
+    for (size_t n = 0; n < e.words.count; n++) {
+        if (e.reasons[n] == NULL) {
+            fprintf(out, "    forth_add_ffi_function(forth, ");
+            emit_string(out, e.words.nodes[n]->name,
+                        strlen(e.words.nodes[n]->name));
+            fprintf(out, ", ");
+            emit_word_name(out, &e, e.words.nodes[n]);
+            fprintf(out, ");\n");
+        }
+    }
+    fprintf(out, "    return 0;\n}\n");
+
+    fprintf(stderr, "emit-c: %zu of %zu words translated\n", translated,
+            e.words.count);
+
+    free(e.reasons);
+    free(e.words.nodes);
+    free(e.cells.nodes);
+    free(e.variables.nodes);
+    free(e.values.nodes);
+    free(e.functions.nodes);
+    free(e.strings);
+    free(e.stack);
+}
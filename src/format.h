@@ -0,0 +1,396 @@
+#pragma once
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+// numbers to text without printf. integers are written backwards from the end
+// of a caller's buffer, floats get the shortest digits that read back as the
+// same double (ryu, Ulf Adams 2018)
+
+__extension__ typedef unsigned __int128 format_u128;
+
+// longest text any of the formatters below produce
+#define FORMAT_MAX 352
+
+static const char format_digits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+static const char format_pairs[] = "00010203040506070809"
+                                   "10111213141516171819"
+                                   "20212223242526272829"
+                                   "30313233343536373839"
+                                   "40414243444546474849"
+                                   "50515253545556575859"
+                                   "60616263646566676869"
+                                   "70717273747576777879"
+                                   "80818283848586878889"
+                                   "90919293949596979899";
+
+// writes n in base ending just before end, returns where it starts
+static char *format_uint(char *end, uint64_t n, unsigned base) {
+    if (base == 10) {
+        while (n >= 100) {
+            unsigned pair = (unsigned) (n % 100) * 2;
+            n /= 100;
+            *--end = format_pairs[pair + 1];
+            *--end = format_pairs[pair];
+        }
+        if (n >= 10) {
+            *--end = format_pairs[n * 2 + 1];
+            *--end = format_pairs[n * 2];
+            return end;
+        }
+        *--end = (char) ('0' + n);
+        return end;
+    }
+
+    do {
+        *--end = format_digits[n % base];
+        n /= base;
+    } while (n != 0);
+    return end;
+}
+
+static char *format_int(char *end, int64_t n, unsigned base) {
+    // the magnitude of INT64_MIN only fits unsigned
+    uint64_t magnitude = n < 0 ? 0 - (uint64_t) n : (uint64_t) n;
+    char *start = format_uint(end, magnitude, base);
+    if (n < 0) {
+        *--start = '-';
+    }
+    return start;
+}
+
+// SHORTEST FLOATS
+
+#define FORMAT_POW5_BITS 125
+#define FORMAT_POW5_COUNT 326
+#define FORMAT_POW5_INV_COUNT 342
+
+// 5^i and 2^k / 5^i scaled to 125 bits, as low and high halves. they are
+// worked out exactly the first time a float is printed instead of being
+// spelled out here
+static uint64_t format_pow5[FORMAT_POW5_COUNT][2];
+static uint64_t format_pow5_inv[FORMAT_POW5_INV_COUNT][2];
+static pthread_once_t format_tables_once = PTHREAD_ONCE_INIT;
+
+// ceil(log2(5^e)), 1 for e = 0
+static inline int32_t format_pow5_bits(int32_t e) {
+    return (int32_t) (((uint32_t) e * 1217359) >> 19) + 1;
+}
+
+// floor(log10(2^e)) and floor(log10(5^e))
+static inline uint32_t format_log10_pow2(int32_t e) {
+    return ((uint32_t) e * 78913) >> 18;
+}
+
+static inline uint32_t format_log10_pow5(int32_t e) {
+    return ((uint32_t) e * 732923) >> 20;
+}
+
+// little endian 32 bit limbs, enough for 2^920
+#define FORMAT_LIMBS 30
+
+static void format_big_mul(uint32_t *big, uint32_t factor) {
+    uint64_t carry = 0;
+    for (int n = 0; n < FORMAT_LIMBS; n++) {
+        uint64_t product = (uint64_t) big[n] * factor + carry;
+        big[n] = (uint32_t) product;
+        carry = product >> 32;
+    }
+}
+
+static void format_big_div(uint32_t *big, uint32_t divisor) {
+    uint64_t rest = 0;
+    for (int n = FORMAT_LIMBS - 1; n >= 0; n--) {
+        uint64_t part = (rest << 32) | big[n];
+        big[n] = (uint32_t) (part / divisor);
+        rest = part % divisor;
+    }
+}
+
+static int32_t format_big_bits(const uint32_t *big) {
+    for (int n = FORMAT_LIMBS - 1; n >= 0; n--) {
+        if (big[n] != 0) {
+            return n * 32 + 32 - __builtin_clz(big[n]);
+        }
+    }
+    return 0;
+}
+
+// count bits of big starting at bit from, which may be below 0
+static void format_big_take(const uint32_t *big, int32_t from, int32_t count,
+                            uint64_t *out) {
+    format_u128 value = 0;
+    for (int32_t bit = count - 1; bit >= 0; bit--) {
+        int32_t at = from + bit;
+        value <<= 1;
+        if (at >= 0 && (big[at / 32] >> (at % 32)) & 1) {
+            value |= 1;
+        }
+    }
+    out[0] = (uint64_t) value;
+    out[1] = (uint64_t) (value >> 64);
+}
+
+static void format_make_tables(void) {
+    uint32_t big[FORMAT_LIMBS] = {1};
+    for (int32_t i = 0; i < FORMAT_POW5_COUNT; i++) {
+        format_big_take(big, format_big_bits(big) - FORMAT_POW5_BITS,
+                        FORMAT_POW5_BITS, format_pow5[i]);
+        format_big_mul(big, 5);
+    }
+
+    for (int32_t q = 0; q < FORMAT_POW5_INV_COUNT; q++) {
+        // floor(2^k / 5^q) + 1, 5^13 is the largest power that fits a limb
+        int32_t k = format_pow5_bits(q) - 1 + FORMAT_POW5_BITS;
+        memset(big, 0, sizeof(big));
+        big[k / 32] = 1u << (k % 32);
+        int32_t left = q;
+        for (; left >= 13; left -= 13) {
+            format_big_div(big, 1220703125);
+        }
+        uint32_t rest = 1;
+        while (left-- > 0) {
+            rest *= 5;
+        }
+        format_big_div(big, rest);
+        // 2^125 + 1 for q = 0 is the one that needs a bit more
+        format_big_take(big, 0, FORMAT_POW5_BITS + 1, format_pow5_inv[q]);
+        format_u128 inv =
+            ((format_u128) format_pow5_inv[q][1] << 64) | format_pow5_inv[q][0];
+        inv += 1;
+        format_pow5_inv[q][0] = (uint64_t) inv;
+        format_pow5_inv[q][1] = (uint64_t) (inv >> 64);
+    }
+}
+
+static inline uint64_t format_mul_shift(uint64_t m, const uint64_t *mul,
+                                        int32_t j) {
+    format_u128 low = (format_u128) m * mul[0];
+    format_u128 high = (format_u128) m * mul[1];
+    return (uint64_t) (((low >> 64) + high) >> (j - 64));
+}
+
+static inline uint32_t format_pow5_factor(uint64_t value) {
+    uint32_t count = 0;
+    while (value % 5 == 0) {
+        value /= 5;
+        count++;
+    }
+    return count;
+}
+
+static inline int format_multiple_of_pow5(uint64_t value, uint32_t p) {
+    return format_pow5_factor(value) >= p;
+}
+
+static inline int format_multiple_of_pow2(uint64_t value, uint32_t p) {
+    return (value & ((1ull << p) - 1)) == 0;
+}
+
+// a finite nonzero double as digits * 10^exponent with as few digits as
+// possible, the closest such number when there are several
+typedef struct {
+    uint64_t digits;
+    int32_t exponent;
+} format_decimal_t;
+
+static format_decimal_t format_shortest(double value) {
+    pthread_once(&format_tables_once, format_make_tables);
+
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint64_t ieee_mantissa = bits & ((1ull << 52) - 1);
+    uint32_t ieee_exponent = (uint32_t) ((bits >> 52) & 0x7ff);
+
+    int32_t e2;
+    uint64_t m2;
+    if (ieee_exponent == 0) {
+        e2 = 1 - 1023 - 52 - 2;
+        m2 = ieee_mantissa;
+    } else {
+        e2 = (int32_t) ieee_exponent - 1023 - 52 - 2;
+        m2 = (1ull << 52) | ieee_mantissa;
+    }
+    int accept_bounds = (m2 & 1) == 0;
+
+    // the interval of reals that round to value is (vm, vp) around vr
+    uint64_t mv = 4 * m2;
+    uint32_t mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+    uint64_t vr, vp, vm;
+    int32_t e10;
+    int vm_trailing_zeros = 0;
+    int vr_trailing_zeros = 0;
+
+    if (e2 >= 0) {
+        uint32_t q = format_log10_pow2(e2) - (e2 > 3);
+        e10 = (int32_t) q;
+        int32_t k = FORMAT_POW5_BITS + format_pow5_bits((int32_t) q) - 1;
+        int32_t i = -e2 + (int32_t) q + k;
+        const uint64_t *mul = format_pow5_inv[q];
+        vr = format_mul_shift(4 * m2, mul, i);
+        vp = format_mul_shift(4 * m2 + 2, mul, i);
+        vm = format_mul_shift(4 * m2 - 1 - mm_shift, mul, i);
+        if (q <= 21) {
+            if (mv % 5 == 0) {
+                vr_trailing_zeros = format_multiple_of_pow5(mv, q);
+            } else if (accept_bounds) {
+                vm_trailing_zeros =
+                    format_multiple_of_pow5(mv - 1 - mm_shift, q);
+            } else {
+                vp -= format_multiple_of_pow5(mv + 2, q);
+            }
+        }
+    } else {
+        uint32_t q = format_log10_pow5(-e2) - (-e2 > 1);
+        e10 = (int32_t) q + e2;
+        int32_t i = -e2 - (int32_t) q;
+        int32_t k = format_pow5_bits(i) - FORMAT_POW5_BITS;
+        int32_t j = (int32_t) q - k;
+        const uint64_t *mul = format_pow5[i];
+        vr = format_mul_shift(4 * m2, mul, j);
+        vp = format_mul_shift(4 * m2 + 2, mul, j);
+        vm = format_mul_shift(4 * m2 - 1 - mm_shift, mul, j);
+        if (q <= 1) {
+            vr_trailing_zeros = 1;
+            if (accept_bounds) {
+                vm_trailing_zeros = mm_shift == 1;
+            } else {
+                vp--;
+            }
+        } else if (q < 63) {
+            vr_trailing_zeros = format_multiple_of_pow2(mv, q);
+        }
+    }
+
+    // drop digits while the shorter number stays inside the interval
+    int32_t removed = 0;
+    uint8_t last_removed = 0;
+    uint64_t output;
+    if (vm_trailing_zeros || vr_trailing_zeros) {
+        while (vp / 10 > vm / 10) {
+            vm_trailing_zeros &= vm % 10 == 0;
+            vr_trailing_zeros &= last_removed == 0;
+            last_removed = (uint8_t) (vr % 10);
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        if (vm_trailing_zeros) {
+            while (vm % 10 == 0) {
+                vr_trailing_zeros &= last_removed == 0;
+                last_removed = (uint8_t) (vr % 10);
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+        }
+        // exactly halfway rounds to even
+        if (vr_trailing_zeros && last_removed == 5 && vr % 2 == 0) {
+            last_removed = 4;
+        }
+        output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) ||
+                       last_removed >= 5);
+    } else {
+        int round_up = 0;
+        if (vp / 100 > vm / 100) {
+            round_up = vr % 100 >= 50;
+            vr /= 100;
+            vp /= 100;
+            vm /= 100;
+            removed += 2;
+        }
+        while (vp / 10 > vm / 10) {
+            round_up = vr % 10 >= 5;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        output = vr + (vr == vm || round_up);
+    }
+
+    return (format_decimal_t) {output, e10 + removed};
+}
+
+enum FORMAT_FLOAT_STYLE {
+    FORMAT_FIXED,       // 123.45
+    FORMAT_SCIENTIFIC,  // 1.2345E2
+    FORMAT_ENGINEERING, // 123.45E0, the exponent a multiple of 3
+};
+
+// writes value to buf, which holds at least FORMAT_MAX bytes, and returns
+// the length. the text always has a point so it reads back as a float
+static size_t format_float(char *buf, double value,
+                           enum FORMAT_FLOAT_STYLE style) {
+    char *out = buf;
+    if (signbit(value)) {
+        *out++ = '-';
+        value = -value;
+    }
+    if (isnan(value) || isinf(value)) {
+        memcpy(out, isnan(value) ? "nan" : "inf", 3);
+        return (size_t) (out + 3 - buf);
+    }
+
+    char digits[24];
+    int32_t count = 1;
+    int32_t exponent = 0;
+    digits[0] = '0';
+    if (value != 0) {
+        format_decimal_t decimal = format_shortest(value);
+        char *end = digits + sizeof(digits);
+        char *start = format_uint(end, decimal.digits, 10);
+        count = (int32_t) (end - start);
+        memmove(digits, start, (size_t) count);
+        exponent = decimal.exponent;
+    }
+
+    // the value is 0.digits * 10^point
+    int32_t point = count + exponent;
+    int32_t shown = 0; // power of ten after the digits, with an E
+    int32_t before = point; // digits in front of the point
+    if (style != FORMAT_FIXED) {
+        shown = value == 0 ? 0 : point - 1;
+        if (style == FORMAT_ENGINEERING) {
+            shown -= ((shown % 3) + 3) % 3;
+        }
+        before = point - shown;
+    }
+
+    if (before <= 0) {
+        *out++ = '0';
+        *out++ = '.';
+        for (int32_t n = before; n < 0; n++) {
+            *out++ = '0';
+        }
+        memcpy(out, digits, (size_t) count);
+        out += count;
+    } else if (before >= count) {
+        memcpy(out, digits, (size_t) count);
+        out += count;
+        for (int32_t n = count; n < before; n++) {
+            *out++ = '0';
+        }
+        *out++ = '.';
+    } else {
+        memcpy(out, digits, (size_t) before);
+        out += before;
+        *out++ = '.';
+        memcpy(out, digits + before, (size_t) (count - before));
+        out += count - before;
+    }
+
+    if (style != FORMAT_FIXED) {
+        char exp[8];
+        char *start = format_int(exp + sizeof(exp), shown, 10);
+        *out++ = 'E';
+        memcpy(out, start, (size_t) (exp + sizeof(exp) - start));
+        out += exp + sizeof(exp) - start;
+    }
+    return (size_t) (out - buf);
+}
@@ -1,5 +1,10 @@
+#define _GNU_SOURCE
+
+#include <ctype.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,23 +12,75 @@
 
 #include "builtins.h"
 #include "forth.h"
+#include "aio.h"
+#include "cache.h"
+#include "clone.h"
+#include "par.h"
+#include "profile.h"
+#include "sample.h"
+#include "task.h"
 #include "trie.h"
 
+// code of a redefined word that may still be running, freed on destroy
+typedef struct forth_retired_s {
+    struct forth_retired_s *next;
+    forth_instr_t *code;
+    size_t length;
+} forth_retired_t;
+
+typedef struct forth_program_s {
+    forth_instr_t *code;
+    size_t length;
+    char **params; // names in order of first use, indices into run's params
+    size_t param_count;
+    // the code holds this instance's dictionary nodes, no other can run it
+    const forth_t *owner;
+} forth_program_t;
+
+// call counters for forth_get_stats, which FORTH_STATS=0 leaves at 0
+static inline void forth_count(uint64_t *counter) {
+    if (FORTH_STATS) {
+        (*counter)++;
+    }
+}
+
+// cells nothing was pushed to yet are filled with this byte, so the
+// deepest a stack got is where the pattern starts
+#define STACK_PAINT 0xa5
+
 forth_stack_t stack_init(size_t size) {
     forth_stack_t stack;
 
     stack.data = malloc(size);
     stack.size = size;
     stack.top = 0;
+    stack.fault = 0;
+    memset(stack.data, STACK_PAINT, size);
 
     return stack;
 }
 
 void stack_resize(forth_stack_t *stack, size_t size) {
     stack->data = realloc(stack->data, size);
+    if (size > (size_t) stack->size) {
+        memset((uint8_t *) stack->data + stack->size, STACK_PAINT,
+               size - (size_t) stack->size);
+    }
     stack->size = size;
 }
 
+// cells from the top down to the last one that was ever written
+static int64_t stack_high_water(const forth_stack_t *stack) {
+    forth_type_t paint;
+    memset(&paint, STACK_PAINT, sizeof(paint));
+    int64_t depth = stack->size / (int64_t) sizeof(forth_type_t);
+    while (depth > stack->top &&
+           memcmp(&stack->data[depth - 1], &paint, sizeof(paint)) == 0) {
+        depth--;
+    }
+    return depth;
+}
+
 void stack_destroy(forth_stack_t *stack) {
     free(stack->data);
     stack->data = NULL;
@@ -31,45 +88,39 @@ void stack_destroy(forth_stack_t *stack) {
     stack->top = 0;
 }
 
+// a pop or push that doesn't fit leaves the stack as it was and records a
+// fault, forth_check turns it into a throw
 forth_type_t stack_pop(forth_stack_t *stack) {
-    stack->top--;
-
-    if (stack->top < 0) {
-        FORTH_OUTPUT_FUNCTION("%s:%d: Stack underflow:\n", __FILE_NAME__,
-                              __LINE__);
+    if (stack->top <= 0) {
+        stack->fault = FORTH_THROW_STACK_UNDERFLOW;
+        return forth_i64(0);
     }
-
-    if (stack->top > stack->size) {
-        FORTH_OUTPUT_FUNCTION("%s:%d: Stack overflow:\n", __FILE_NAME__,
-                              __LINE__);
-    }
-
-    return stack->data[stack->top];
+    return stack->data[--stack->top];
 }
 
 forth_type_t stack_peek(forth_stack_t *stack) {
+    if (stack->top <= 0) {
+        stack->fault = FORTH_THROW_STACK_UNDERFLOW;
+        return forth_i64(0);
+    }
     return stack->data[stack->top - 1];
 }
 
+// idx 1 is the top
 forth_type_t stack_peek_idx(forth_stack_t *stack, int64_t idx) {
+    if (idx < 1 || idx > stack->top) {
+        stack->fault = FORTH_THROW_STACK_UNDERFLOW;
+        return forth_i64(0);
+    }
     return stack->data[stack->top - idx];
 }
 
 void stack_push(forth_stack_t *stack, forth_type_t val) {
-    stack->data[stack->top] = val;
-    stack->top++;
-
-    if (stack->top < 0) {
-        FORTH_OUTPUT_FUNCTION(
-            "src2/%s:%d: Stack underflow: Top: %zu, Size: %zu\n", __FILE_NAME__,
-            __LINE__, stack->top, stack->size);
-    }
-
-    if (stack->top > stack->size) {
-        FORTH_OUTPUT_FUNCTION(
-            "src2/%s:%d: Stack overflow: Top: %zu, Size: %zu\n", __FILE_NAME__,
-            __LINE__, stack->top, stack->size);
+    if ((stack->top + 1) * (int64_t) sizeof(forth_type_t) > stack->size) {
+        stack->fault = FORTH_THROW_STACK_OVERFLOW;
+        return;
     }
+    stack->data[stack->top++] = val;
 }
 
 forth_t forth_init(size_t stack_size, size_t heap_size) {
@@ -79,36 +130,138 @@ forth_t forth_init(size_t stack_size, size_t heap_size) {
     forth.data_stack = stack_init(stack_size);
     forth.control_stack = stack_init(stack_size);
 
-    forth.heap = malloc(sizeof(forth_type_t) * heap_size);
+    forth.return_stack.size = stack_size / sizeof(forth_type_t);
+    forth.return_stack.frames =
+        malloc(sizeof(forth_frame_t) * forth.return_stack.size);
+    forth.return_stack.top = 0;
+
+    forth.loop_size = 16;
+    forth.loops = calloc(forth.loop_size, sizeof(forth_loop_t));
+    forth.loop_top = 1;
+
+    forth.fuel = FORTH_FUEL_UNLIMITED;
+    random_seed(forth.random, FORTH_RANDOM_SEED);
+
+    forth.heap_size = sizeof(forth_type_t) * heap_size;
+    forth.heap = malloc(forth.heap_size);
     forth.next_address = 0;
 
+    // state lives on the heap like any other variable
+    forth.state = (forth_type_t *) &forth.heap[forth.next_address];
+    forth.next_address += sizeof(forth_type_t);
+    *forth.state = forth_i64(0);
+
+    forth.base = (forth_type_t *) &forth.heap[forth.next_address];
+    forth.next_address += sizeof(forth_type_t);
+    *forth.base = forth_i64(10);
+    forth.hold_start = FORTH_HOLD_SIZE;
+    forth.transient = calloc(1, FORTH_TRANSIENT_SIZE);
+
     forth.root = trie_create_blank_node();
 
     forth_register_all_builtins(&forth);
+    forth_define_variable(&forth, "state", forth.state);
+    forth_define_variable(&forth, "base", forth.base);
 
     return forth;
 }
 
+static void forth_abandon(forth_t *forth);
+
 void forth_destroy(forth_t *forth) {
+    forth_abandon(forth);
+
+    par_destroy(forth->par);
+    forth->par = NULL;
+
+    // waits for requests still reading into or writing from the heap
+    aio_destroy(forth->aio);
+    forth->aio = NULL;
+
     stack_destroy(&forth->data_stack);
     stack_destroy(&forth->control_stack);
 
+    free(forth->return_stack.frames);
+    forth->return_stack.frames = NULL;
+    forth->return_stack.size = 0;
+    forth->return_stack.top = 0;
+
+    free(forth->loops);
+    forth->loops = NULL;
+    forth->loop_size = 0;
+    forth->loop_top = 0;
+
+    forth_abort_compile(forth);
+    free(forth->code);
+    forth->code = NULL;
+    forth->code_capacity = 0;
+
+    while (forth->retired != NULL) {
+        forth_retired_t *retired = forth->retired;
+        forth->retired = retired->next;
+        trie_free_code(retired->code, retired->length);
+        free(retired);
+    }
+
+    cache_destroy(forth->cache);
+    forth->cache = NULL;
+
+    trie_destroy(forth->root);
+    while (forth->blocks != NULL) {
+        trie_block_t *block = forth->blocks;
+        forth->blocks = block->next;
+        free(block);
+    }
+    forth->root = NULL;
+
     free(forth->heap);
     forth->heap = NULL;
+    forth->state = NULL;
+    free(forth->transient);
+    forth->transient = NULL;
 
-    trie_destroy(forth->root);
+    for (size_t n = 0; n < forth->region_count; n++) {
+        (void) forth_drop_region(&forth->regions[n]);
+    }
+    free(forth->regions);
+    forth->regions = NULL;
+    forth->region_count = 0;
+    free(forth->xts);
+    forth->xts = NULL;
+    forth->xt_count = 0;
+    forth->xt_capacity = 0;
+
+    profile_destroy(forth->profile);
+    forth->profile = NULL;
+    sample_destroy(forth->sampler);
+    forth->sampler = NULL;
+    forth->profiling = 0;
+
+    task_destroy_all(forth);
 }
 
 void forth_define_word(forth_t *forth, const char *name,
                        const char *definition) {
-    trie_insert_userword(forth->root, name, definition);
+    size_t len = strlen(name) + strlen(definition) + 6;
+    char *code = malloc(len);
+    snprintf(code, len, ": %s %s ;", name, definition);
+    forth_eval(forth, code);
+    free(code);
+}
+
+const char *forth_lookup_word(forth_t *forth, const char *name) {
+    trie_node_t *node = trie_search(forth->root, name);
+    if (node == NULL || node->node_type != TRIE_USERWORD) {
+        return NULL;
+    }
+    return node->userword_def;
 }
 
-static int parse_integer(const char *word, int64_t *out) {
+static int parse_integer(const char *word, unsigned base, int64_t *out) {
     char *end;
     errno = 0;
 
-    int64_t val = strtoll(word, &end, 10);
+    int64_t val = strtoll(word, &end, (int) base);
 
     if (*end == '\0' && errno == 0) {
         *out = val;
@@ -132,151 +285,1571 @@ static int parse_float(const char *word, double *out) {
     return 0;
 }
 
-char *remove_comments(const char *input) {
-    size_t len = strlen(input);
-    char *cleaned = malloc(len + 1);
-    if (cleaned == NULL) {
+static int forth_eval_finish(forth_t *forth, int nested);
+
+int forth_import_file(forth_t *forth, const char *filename) {
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+        forth_throw(forth, FORTH_THROW_NO_FILE, "can't open '%s'", filename);
+        return forth_eval_finish(forth, forth->source != NULL ||
+                                            forth->return_stack.top > 0);
+    }
+
+    fseek(fp, 0, SEEK_END);
+    size_t len = ftell(fp);
+    rewind(fp);
+
+    char *buffer = malloc(len + 1);
+    len = fread(buffer, 1, len, fp);
+    buffer[len] = '\0';
+    fclose(fp);
+
+    int code = forth_eval(forth, buffer);
+    free(buffer);
+    return code;
+}
+
+void forth_add_ffi_function(forth_t *forth, const char *name,
+                            forth_ffi_fn_ptr fn) {
+    trie_insert_ffi_function(forth, name, fn);
+}
+
+// a cell outside the heap becomes a region of its own
+void forth_define_variable(forth_t *forth, const char *name,
+                           forth_type_t *val) {
+    size_t offset = (uintptr_t) val - (uintptr_t) forth->heap;
+    forth_type_t ref = offset < forth->heap_size
+                           ? forth_ref(offset)
+                           : forth_add_region(forth, val, sizeof(*val));
+    trie_insert_variable(forth, name, ref);
+}
+
+// NULL if name isn't something that leaves the address of a cell
+forth_type_t *forth_get_variable(forth_t *forth, const char *name) {
+    if (forth_eval(forth, name) != 0 || forth->data_stack.top == 0) {
+        return NULL;
+    }
+    forth_type_t addr = stack_pop(&forth->data_stack);
+    if (addr.tag != FORTH_REF) {
         return NULL;
     }
+    return forth_addr(forth, addr.ref, sizeof(forth_type_t));
+}
 
-    int in_parens = 0;
-    size_t j = 0;
+// NULL if name isn't a value
+forth_type_t *forth_get_value(forth_t *forth, const char *name) {
+    trie_node_t *node = trie_search(forth->root, name);
+    if (node == NULL || node->node_type != TRIE_VALUE) {
+        return NULL;
+    }
+    return (forth_type_t *) (forth->heap + node->var.ref);
+}
 
-    for (size_t i = 0; i < len; i++) {
-        if (input[i] == '\\') {
-            // skip to the end of the line
-            while (i < len && input[i] != '\n') {
-                i++;
-            }
-        }
+// counts the instances a map-file mapping is a region of, a clone shares
+// its parent's
+struct forth_mapping_s {
+    atomic_size_t refs;
+};
 
-        if (input[i] == '(') {
-            in_parens++;
-            continue;
-        } else if (input[i] == ')' && in_parens) {
-            in_parens--;
-            continue;
-        }
+// freed entries are taken again before the table grows
+static forth_type_t forth_new_region(forth_t *forth, void *base, size_t size,
+                                     int mapped) {
+    // par-do workers share the table with the instance that started them
+    if (par_capture != NULL) {
+        forth_throw(forth, FORTH_THROW_UNSUPPORTED,
+                    "adding a region inside par-do");
+        return forth_ref(0);
+    }
+    if (size >= (size_t) 1 << FORTH_SEGMENT_BITS) {
+        forth_throw(forth, FORTH_THROW_OUT_OF_RANGE,
+                    "region of %zu bytes is too large", size);
+        return forth_ref(0);
+    }
 
-        if (!in_parens && input[i] != '#' && input[i] != '\r') {
-            cleaned[j++] = input[i];
-        }
+    size_t n = 0;
+    while (n < forth->region_count && forth->regions[n].base != NULL) {
+        n++;
     }
+    if (n == forth->region_count) {
+        forth->region_count++;
+        forth->regions = realloc(forth->regions, sizeof(forth_segment_t) *
+                                                     forth->region_count);
+    }
+    forth->regions[n] = (forth_segment_t) {base, size, NULL};
+    if (mapped) {
+        forth->regions[n].mapping = malloc(sizeof(struct forth_mapping_s));
+        atomic_init(&forth->regions[n].mapping->refs, 1);
+    }
+    return forth_ref(forth_segment_ref(FORTH_SEGMENT_FIRST_REGION + n, 0));
+}
 
-    cleaned[j] = '\0';
-    return cleaned;
+forth_type_t forth_add_region(forth_t *forth, void *base, size_t size) {
+    return forth_new_region(forth, base, size, 0);
 }
 
-char **tokenize_words(const char *code, size_t *out_count) {
-    char *cleaned = remove_comments(code);
-    if (cleaned == NULL) {
+// the region ref is the start of, NULL if it isn't the start of one
+static forth_segment_t *forth_region(forth_t *forth, forth_type_t ref) {
+    size_t n = (ref.ref >> FORTH_SEGMENT_BITS) - FORTH_SEGMENT_FIRST_REGION;
+    if (ref.tag != FORTH_REF || n >= forth->region_count ||
+        forth_segment_ref(FORTH_SEGMENT_FIRST_REGION + n, 0) != ref.ref ||
+        forth->regions[n].base == NULL) {
         return NULL;
     }
+    return &forth->regions[n];
+}
 
-#define MAX_TOKENS 8192
+// another instance now uses the region too
+static void forth_share_region(forth_segment_t *region) {
+    if (region->mapping != NULL) {
+        atomic_fetch_add(&region->mapping->refs, 1);
+    }
+}
 
-    char **tokens = malloc(sizeof(char *) * MAX_TOKENS);
-    int count = 0;
+// the instance stops using the region, a mapping is unmapped once no
+// instance does. 0 or a negated errno
+static int forth_drop_region(forth_segment_t *region) {
+    int ior = 0;
+    if (region->mapping != NULL &&
+        atomic_fetch_sub(&region->mapping->refs, 1) == 1) {
+        ior = munmap(region->base, region->size) < 0 ? -errno : 0;
+        free(region->mapping);
+    }
+    *region = (forth_segment_t) {0};
+    return ior;
+}
 
-    char *token = strtok(cleaned, " \t\n");
-    while (token && count < MAX_TOKENS) {
-        tokens[count++] = strdup(token);
-        token = strtok(NULL, " \t\n");
+void forth_remove_region(forth_t *forth, forth_type_t ref) {
+    forth_segment_t *region = forth_region(forth, ref);
+    if (region != NULL) {
+        (void) forth_drop_region(region);
     }
+}
 
-#undef MAX_TOKENS
+// everything but the heap, which forth_addr checks itself
+void *forth_segment_addr(const forth_t *forth, size_t ref, size_t len) {
+    size_t segment = ref >> FORTH_SEGMENT_BITS;
+    size_t offset = ref & (((size_t) 1 << FORTH_SEGMENT_BITS) - 1);
 
-    free(cleaned);
-    *out_count = count;
-    return tokens;
+    uint8_t *base = NULL;
+    size_t size = 0;
+    if (segment == FORTH_SEGMENT_HOLD) {
+        base = (uint8_t *) forth->hold;
+        size = FORTH_HOLD_SIZE;
+    } else if (segment == FORTH_SEGMENT_TRANSIENT) {
+        base = (uint8_t *) forth->transient;
+        size = FORTH_TRANSIENT_SIZE;
+    } else if (segment >= FORTH_SEGMENT_FIRST_REGION &&
+               segment - FORTH_SEGMENT_FIRST_REGION < forth->region_count) {
+        base = forth->regions[segment - FORTH_SEGMENT_FIRST_REGION].base;
+        size = forth->regions[segment - FORTH_SEGMENT_FIRST_REGION].size;
+    }
+    if (base == NULL || offset > size || len > size - offset) {
+        return NULL;
+    }
+    return base + offset;
 }
 
-void forth_import_file(forth_t *forth, const char *filename) {
-    FILE *fp = fopen(filename, "r");
+// NULL if name isn't a builtin or ffi function
+forth_ffi_fn_ptr forth_get_function(forth_t *forth, const char *name) {
+    trie_node_t *node = trie_search(forth->root, name);
+    if (node == NULL) {
+        return NULL;
+    }
+    if (node->node_type == TRIE_BUILTIN) {
+        return node->builtin_fn;
+    }
+    return node->node_type == TRIE_FFI_FN ? node->ffi_fn : NULL;
+}
+
+static void forth_count_nodes(const trie_node_t *node, forth_stats_t *stats) {
+    stats->dictionary_nodes++;
+    stats->dictionary_bytes += sizeof(trie_node_t) +
+                               sizeof(forth_instr_t) * node->code_length;
+    if (node->name != NULL) {
+        stats->dictionary_bytes += strlen(node->name) + 1;
+    }
+    if (node->userword_def != NULL) {
+        stats->dictionary_bytes += node->userword_def_len + 1;
+    }
+    for (size_t i = 0; i < ALPHABET_SIZE; i++) {
+        if (node->children[i] != NULL) {
+            forth_count_nodes(node->children[i], stats);
+        }
+    }
+}
+
+forth_stats_t forth_get_stats(forth_t *forth) {
+    forth_stats_t stats = forth->stats;
+
+    // the interpreter counts ffi calls as builtin calls too
+    stats.builtin_calls -= stats.ffi_calls;
+    stats.words_executed =
+        stats.user_calls + stats.builtin_calls + stats.ffi_calls;
+
+    stats.data_stack_max = stack_high_water(&forth->data_stack);
+    stats.control_stack_max = stack_high_water(&forth->control_stack);
+    stats.heap_used = forth->next_address;
+    if (stats.heap_peak < forth->next_address) {
+        stats.heap_peak = forth->next_address;
+    }
+    stats.heap_size = forth->heap_size;
+    forth_count_nodes(forth->root, &stats);
+    return stats;
+}
+
+// stack cells above the top are painted again, so the depths start over
+// from where the stacks are now
+void forth_reset_stats(forth_t *forth) {
+    forth->stats = (forth_stats_t) {0};
+    forth_stack_t *stacks[] = {&forth->data_stack, &forth->control_stack};
+    for (size_t n = 0; n < 2; n++) {
+        forth_stack_t *stack = stacks[n];
+        memset(&stack->data[stack->top], STACK_PAINT,
+               (size_t) stack->size - sizeof(forth_type_t) * stack->top);
+    }
+}
+
+void forth_profile_start(forth_t *forth) {
+    if (forth->profile == NULL) {
+        forth->profile = profile_create();
+    }
+
+    // anything still on the activation stack belongs to a previous run
+    forth->profile->depth = 0;
+    forth->profile->current = &forth->profile->root;
+    forth->profiling |= FORTH_PROFILE_TIMING;
+}
+
+void forth_profile_stop(forth_t *forth) {
+    forth->profiling &= ~FORTH_PROFILE_TIMING;
+}
+
+void forth_profile_reset(forth_t *forth) {
+    if (forth->profile != NULL) {
+        profile_clear_tree(forth->profile);
+    }
+}
+
+void forth_profile_report(forth_t *forth) {
+    if (forth->profile == NULL) {
+        FORTH_ERROR_FUNCTION("Error: no profile recorded\n");
+        return;
+    }
+    profile_print_report(forth->profile);
+}
+
+int forth_profile_write_folded(forth_t *forth, const char *filename) {
+    if (forth->profile == NULL) {
+        FORTH_ERROR_FUNCTION("Error: no profile recorded\n");
+        return -1;
+    }
+
+    FILE *fp = fopen(filename, "w");
     if (fp == NULL) {
         FORTH_ERROR_FUNCTION("Error opening '%s'\n", filename);
+        return -1;
+    }
+
+    profile_write_folded(forth->profile, fp);
+    fclose(fp);
+    return 0;
+}
+
+int forth_sample_start(forth_t *forth, unsigned interval_us) {
+    if (forth->sampler == NULL) {
+        forth->sampler = sample_create();
+    }
+
+    if (interval_us == 0) {
+        interval_us = 1000;
+    }
+
+    int mode = sample_start(forth->sampler, interval_us);
+    if (mode < 0) {
+        FORTH_ERROR_FUNCTION("Error: could not start the sampling profiler\n");
+        return -1;
+    }
+
+    forth->sampler->depth = 0;
+    forth->profiling |= FORTH_PROFILE_SAMPLING;
+    return mode;
+}
+
+void forth_sample_stop(forth_t *forth) {
+    if (forth->sampler != NULL) {
+        sample_stop(forth->sampler);
+    }
+    forth->profiling &= ~FORTH_PROFILE_SAMPLING;
+}
+
+void forth_sample_reset(forth_t *forth) {
+    if (forth->sampler != NULL) {
+        forth->sampler->count = 0;
+        forth->sampler->dropped = 0;
+    }
+}
+
+void forth_sample_report(forth_t *forth) {
+    if (forth->sampler == NULL) {
+        FORTH_ERROR_FUNCTION("Error: no samples recorded\n");
         return;
     }
+    sample_print_report(forth->sampler);
+}
 
-    fseek(fp, 0, SEEK_END);
-    size_t len = ftell(fp);
-    rewind(fp);
+int forth_sample_write_folded(forth_t *forth, const char *filename) {
+    if (forth->sampler == NULL) {
+        FORTH_ERROR_FUNCTION("Error: no samples recorded\n");
+        return -1;
+    }
 
-    char *buffer = malloc(len + 1);
-    fread(buffer, len, 1, fp);
-    buffer[len] = '\0';
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL) {
+        FORTH_ERROR_FUNCTION("Error opening '%s'\n", filename);
+        return -1;
+    }
 
-    forth_eval(forth, buffer);
-    free(buffer);
+    sample_write_folded(forth->sampler, fp);
+    fclose(fp);
+    return 0;
 }
 
-void forth_add_ffi_function(forth_t *forth, const char *name,
-                            forth_ffi_fn_ptr fn) {
-    trie_insert_ffi_function(forth->root, name, fn);
+static inline void forth_profile_enter(forth_t *forth, trie_node_t *node,
+                                       int profiled) {
+    if (profiled & FORTH_PROFILE_TIMING) {
+        profile_enter(forth->profile, node);
+    }
+    if (profiled & FORTH_PROFILE_SAMPLING) {
+        sample_push(forth->sampler, node);
+    }
 }
 
-void forth_define_variable(forth_t *forth, const char *name,
-                           forth_type_t *val) {
-    trie_insert_variable(forth->root, name, forth_ref((size_t) val));
+static inline void forth_profile_exit(forth_t *forth, int profiled) {
+    if (profiled & FORTH_PROFILE_TIMING) {
+        profile_exit(forth->profile);
+    }
+    if (profiled & FORTH_PROFILE_SAMPLING) {
+        sample_pop(forth->sampler);
+    }
 }
 
-forth_type_t *forth_get_variable(forth_t *forth, const char *name) {
-    forth_eval(forth, name);
-    forth_type_t addr = stack_pop(&forth->data_stack);
-    if (addr.tag != FORTH_REF) {
-        FORTH_ERROR_FUNCTION("Error: Dereferencing non-reference type\n");
+// ERRORS
+
+void forth_throw(forth_t *forth, int code, const char *fmt, ...) {
+    if (code == 0 || forth->error != 0) {
+        return;
     }
+    forth->error = code;
 
-    forth_type_t *ptr = (forth_type_t *) addr.ref;
-    return ptr;
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(forth->error_message, sizeof(forth->error_message), fmt, args);
+    va_end(args);
 }
 
-void forth_eval(forth_t *forth, const char *code) {
-    size_t words_length;
-    char **words = tokenize_words(code, &words_length);
+const char *forth_error_message(forth_t *forth) {
+    return forth->error_message;
+}
 
-    for (size_t i = 0; i < words_length; i++) {
-        int64_t i64_val;
-        double f64_val;
+// INPUT
 
-        const char *word = words[i];
+size_t forth_parse_name(forth_t *forth, char *buf, size_t size) {
+    forth_source_t *src = forth->source;
+    buf[0] = '\0';
+    if (src == NULL) {
+        return 0;
+    }
 
-        if (parse_integer(word, &i64_val)) {
-            stack_push(&forth->data_stack, forth_i64(i64_val));
-        } else if (parse_float(word, &f64_val)) {
-            stack_push(&forth->data_stack, forth_f64(f64_val));
-        } else {
-            trie_node_t *node = trie_search(forth->root, word);
-            // printf("node for '%s' at %p\n", word, node);
+    while (src->offset < src->length &&
+           isspace((unsigned char) src->text[src->offset])) {
+        src->offset++;
+    }
+
+    size_t start = src->offset;
+    while (src->offset < src->length &&
+           !isspace((unsigned char) src->text[src->offset])) {
+        src->offset++;
+    }
+
+    size_t len = src->offset - start;
+    if (len >= size) {
+        len = size - 1;
+    }
+    memcpy(buf, &src->text[start], len);
+    buf[len] = '\0';
+
+    // the delimiter belongs to the name, so ." hello" parses "hello"
+    if (src->offset < src->length) {
+        src->offset++;
+    }
+    return len;
+}
+
+const char *forth_parse(forth_t *forth, char delim, size_t *length) {
+    forth_source_t *src = forth->source;
+    if (src == NULL) {
+        *length = 0;
+        return "";
+    }
+
+    const char *start = &src->text[src->offset];
+    const char *end = memchr(start, delim, src->length - src->offset);
+
+    if (end == NULL) {
+        *length = src->length - src->offset;
+        src->offset = src->length;
+    } else {
+        *length = (size_t) (end - start);
+        src->offset += *length + 1;
+    }
+    return start;
+}
+
+// COMPILER
+
+void forth_compile(forth_t *forth, forth_instr_t instr) {
+    if (forth->code_length == forth->code_capacity) {
+        forth->code_capacity =
+            forth->code_capacity ? forth->code_capacity * 2 : 64;
+        forth->code = realloc(forth->code,
+                              sizeof(forth_instr_t) * forth->code_capacity);
+    }
+    forth->code[forth->code_length++] = instr;
+}
+
+void forth_abort_compile(forth_t *forth) {
+    // strings of ." belong to the code being thrown away
+    for (size_t i = 0; i < forth->code_length; i++) {
+        if (forth->code[i].op == OP_PRINT) {
+            free(forth->code[i].string);
+        }
+    }
+    forth->code_length = 0;
+
+    if (forth->state->int64 || forth->defining) {
+        if (forth->defining && forth->latest != NULL &&
+            forth->latest_type == TRIE_NONE) {
+            forth->latest->node_type = TRIE_NONE;
+        }
+        if (forth->control_stack.top > forth->compile_base) {
+            forth->control_stack.top = forth->compile_base;
+        }
+    }
+
+    forth->state->int64 = 0;
+    forth->defining = 0;
+    forth->anonymous = 0;
+}
+
+static void forth_begin_compile(forth_t *forth) {
+    forth->state->int64 = -1;
+    forth->compile_base = forth->control_stack.top;
+    forth->code_length = 0;
+}
+
+void forth_begin_definition(forth_t *forth, const char *name) {
+    if (forth->defining) {
+        forth_throw(forth, FORTH_THROW_NESTED_COMPILE,
+                    "nested definition of '%s'", name);
+        forth_abort_compile(forth);
+        return;
+    }
+
+    trie_node_t *node = trie_insert_key(forth->root, name);
+
+    forth->latest = node;
+    forth->latest_type = node->node_type;
+    if (node->node_type == TRIE_NONE) {
+        // visible right away so the word can call itself by name
+        node->node_type = TRIE_USERWORD;
+    }
+
+    forth_begin_compile(forth);
+    forth->defining = 1;
+    forth->anonymous = 0;
+    forth->def_source = forth->source ? forth->source->id : 0;
+    forth->def_start = forth->source ? forth->source->offset : 0;
+}
+
+// control structures typed outside a definition are compiled into an
+// anonymous definition that runs as soon as the structure is closed
+static void forth_begin_anonymous(forth_t *forth) {
+    forth_begin_compile(forth);
+    forth->anonymous = 1;
+}
+
+// finishes the code being compiled and hands back a copy of it
+static forth_instr_t *forth_finish_code(forth_t *forth, size_t *length) {
+    forth_compile(forth, (forth_instr_t) {.op = OP_EXIT});
+
+    // a call right before an exit doesn't need to come back
+    for (size_t i = 0; i + 1 < forth->code_length; i++) {
+        if (forth->code[i].op == OP_CALL &&
+            forth->code[i + 1].op == OP_EXIT) {
+            forth->code[i].op = OP_TAIL_CALL;
+        }
+    }
+
+    *length = forth->code_length;
+    forth_instr_t *code = malloc(sizeof(forth_instr_t) * *length);
+    memcpy(code, forth->code, sizeof(forth_instr_t) * *length);
+
+    forth->code_length = 0;
+    forth->state->int64 = 0;
+    forth->defining = 0;
+    forth->anonymous = 0;
+    return code;
+}
+
+void forth_end_definition(forth_t *forth) {
+    if (!forth->defining || forth->latest == NULL) {
+        forth_throw(forth, FORTH_THROW_CONTROL_MISMATCH, "';' without ':'");
+        forth_abort_compile(forth);
+        return;
+    }
+    if (forth->control_stack.top != forth->compile_base) {
+        forth_throw(forth, FORTH_THROW_CONTROL_MISMATCH,
+                    "unclosed control structure in '%s'", forth->latest->name);
+        forth_abort_compile(forth);
+        return;
+    }
+
+    // keep the source text when the whole definition came from one string
+    const char *def = NULL;
+    size_t def_len = 0;
+    forth_source_t *src = forth->source;
+    if (src != NULL && src->id == forth->def_source) {
+        size_t end = src->offset;
+        while (end > forth->def_start && src->text[end - 1] != ';') {
+            end--;
+        }
+        if (end > forth->def_start) {
+            end--;
+        }
+        while (end > forth->def_start &&
+               isspace((unsigned char) src->text[end - 1])) {
+            end--;
+        }
+        def = &src->text[forth->def_start];
+        def_len = end - forth->def_start;
+    }
 
-            if (node == NULL) {
-                FORTH_ERROR_FUNCTION("Error: word '%s' undefined\n", word);
-                return;
+    size_t length;
+    forth_instr_t *code = forth_finish_code(forth, &length);
+    trie_node_t *node = forth->latest;
+
+    trie_insert_userword(forth, node->name, code, length, def, def_len);
+    forth->latest_type = TRIE_USERWORD;
+}
+
+// whatever redefines a word, the old code may be somewhere up the return
+// stack, or where a suspended task continues, so it is kept until destroy
+static void forth_retire(forth_t *forth, trie_node_t *node) {
+    if (node->node_type != TRIE_USERWORD || node->code == NULL) {
+        return;
+    }
+    if (forth->return_stack.top > 0 || task_pending(forth)) {
+        forth_retired_t *retired = malloc(sizeof(forth_retired_t));
+        retired->next = forth->retired;
+        retired->code = node->code;
+        retired->length = node->code_length;
+        forth->retired = retired;
+    } else {
+        trie_free_code(node->code, node->code_length);
+    }
+    node->code = NULL;
+    node->code_length = 0;
+}
+
+// copies the body of a small word into the code being compiled, behind a
+// guard that falls back to a call if the word is redefined later
+static int forth_compile_inline(forth_t *forth, trie_node_t *node) {
+    if (node->code == NULL || node->code_length - 1 > FORTH_INLINE_THRESHOLD ||
+        (forth->defining && node == forth->latest)) {
+        return 0;
+    }
+
+    size_t length = node->code_length - 1; // without the final exit
+    forth_compile(forth, (forth_instr_t) {
+                             .op = OP_INLINE,
+                             .node = node,
+                             .version = node->version,
+                             .skip = (int32_t) length + 1,
+                         });
+
+    for (size_t i = 0; i < length; i++) {
+        forth_instr_t instr = node->code[i];
+        switch (instr.op) {
+        case OP_EXIT:
+            instr = (forth_instr_t) {
+                .op = OP_BRANCH,
+                .offset = (int64_t) (length - i),
+            };
+            break;
+        case OP_TAIL_CALL:
+            instr.op = OP_CALL;
+            break;
+        case OP_PRINT:
+            instr.string = strdup(instr.string);
+            break;
+        default:
+            break;
+        }
+        forth_compile(forth, instr);
+    }
+    return 1;
+}
+
+static void forth_compile_node(forth_t *forth, trie_node_t *node) {
+    switch (node->node_type) {
+    case TRIE_NONE:
+        break;
+    case TRIE_FFI_FN:
+        forth_compile(forth, (forth_instr_t) {
+                                 .op = OP_FFI_FN,
+                                 .node = node,
+                                 .fn = node->ffi_fn,
+                             });
+        break;
+    case TRIE_USERWORD:
+        if (!forth_compile_inline(forth, node)) {
+            forth_compile(forth,
+                          (forth_instr_t) {.op = OP_CALL, .node = node});
+        }
+        break;
+    case TRIE_BUILTIN:
+        forth_compile(forth, (forth_instr_t) {
+                                 .op = OP_BUILTIN,
+                                 .node = node,
+                                 .fn = node->builtin_fn,
+                             });
+        break;
+    case TRIE_VARIABLE:
+        forth_compile(forth,
+                      (forth_instr_t) {.op = OP_LITERAL, .literal = node->var});
+        break;
+    case TRIE_VALUE:
+        forth_compile(forth,
+                      (forth_instr_t) {.op = OP_FETCH, .literal = node->var});
+        break;
+    }
+}
+
+// INNER INTERPRETER
+
+static void forth_execute(forth_t *forth, trie_node_t *node);
+
+static int forth_grow_return_stack(forth_rstack_t *rstack) {
+    if (rstack->size >= MAX_RETURN_DEPTH) {
+        return 0;
+    }
+
+    int64_t size = rstack->size ? rstack->size * 2 : 64;
+    if (size > MAX_RETURN_DEPTH) {
+        size = MAX_RETURN_DEPTH;
+    }
+    rstack->frames = realloc(rstack->frames, sizeof(forth_frame_t) * size);
+    rstack->size = size;
+    return 1;
+}
+
+// returns from where there is no exit of the word's own to go on to, like
+// the end of a par-do chunk
+static const forth_instr_t forth_exit = {.op = OP_EXIT};
+
+// a throw is pending or a push or pop didn't fit, checked after anything
+// that can fail so nothing runs on with a broken stack
+static inline int forth_failed(const forth_t *forth) {
+    return __builtin_expect((forth->data_stack.fault |
+                             forth->control_stack.fault | forth->error) != 0,
+                            0);
+}
+
+// charged at calls and backward branches, so every loop pays for itself.
+// the run keeps fuel in a local and hands it back around anything that
+// could run code of its own
+static inline int forth_spend_fuel(int64_t *fuel) {
+    return __builtin_expect(--*fuel < 0, 0);
+}
+
+static inline __attribute__((always_inline)) void
+forth_run_code(forth_t *forth, const forth_instr_t *ip, trie_node_t *word,
+               const int profiled) {
+    forth_stack_t *data = &forth->data_stack;
+    forth_rstack_t *rstack = &forth->return_stack;
+    int64_t base = rstack->top;
+    int64_t loop_base = forth->loop_top;
+    int64_t fuel = forth->fuel;
+
+    // a run that ran out of fuel left its frames on the return stack, it
+    // goes on from where it stopped
+    if (ip == NULL) {
+        ip = forth->suspended.ip;
+        base = 0;
+        loop_base = forth->suspended.loop_base;
+        forth->suspended.ip = NULL;
+        goto resume;
+    }
+
+    if (rstack->top == rstack->size && !forth_grow_return_stack(rstack)) {
+        goto overflow;
+    }
+    rstack->frames[rstack->top++] = (forth_frame_t) {NULL, word};
+    if (profiled && word != NULL) {
+        forth_profile_enter(forth, word, profiled);
+    }
+
+resume:
+    for (;;) {
+        switch (ip->op) {
+        case OP_LITERAL:
+            stack_push(data, ip->literal);
+            ip++;
+            break;
+        case OP_FFI_FN:
+            forth_count(&forth->stats.ffi_calls);
+            // fall through
+        case OP_BUILTIN:
+            forth_count(&forth->stats.builtin_calls);
+            if (profiled) {
+                forth_profile_enter(forth, ip->node, profiled);
+            }
+            forth->fuel = fuel;
+            ip->fn(forth);
+            fuel = forth->fuel;
+            if (profiled) {
+                forth_profile_exit(forth, profiled);
+            }
+            if (forth_failed(forth)) {
+                goto fail;
+            }
+            ip++;
+            break;
+        case OP_CALL:
+            if (forth_spend_fuel(&fuel)) {
+                goto out_of_fuel;
+            }
+            if (__builtin_expect(ip->node->node_type != TRIE_USERWORD, 0)) {
+                // redefined as something other than a user word since the
+                // call was compiled
+                forth->fuel = fuel;
+                forth_execute(forth, ip->node);
+                fuel = forth->fuel;
+                if (forth_failed(forth)) {
+                    goto fail;
+                }
+                ip++;
+                break;
+            }
+            if (rstack->top == rstack->size &&
+                !forth_grow_return_stack(rstack)) {
+                goto overflow;
+            }
+            forth_count(&forth->stats.user_calls);
+            rstack->frames[rstack->top++] = (forth_frame_t) {ip + 1, ip->node};
+            if (profiled) {
+                forth_profile_enter(forth, ip->node, profiled);
+            }
+            ip = ip->node->code;
+            break;
+        case OP_INLINE:
+            if (ip->node->version == ip->version) {
+                forth_count(&forth->stats.user_calls);
+                ip++;
+                break;
             }
 
-            switch (node->node_type) {
-            case TRIE_NONE:
-                FORTH_ERROR_FUNCTION(
-                    "Error: word '%s' defined with no node type\n", word);
+            // redefined since it was inlined, call what it is now instead
+            if (ip->node->node_type != TRIE_USERWORD) {
+                forth->fuel = fuel;
+                forth_execute(forth, ip->node);
+                fuel = forth->fuel;
+                if (forth_failed(forth)) {
+                    goto fail;
+                }
+                ip += ip->skip;
                 break;
-            case TRIE_FFI_FN:
-                node->ffi_fn(forth);
+            }
+            if (rstack->top == rstack->size &&
+                !forth_grow_return_stack(rstack)) {
+                goto overflow;
+            }
+            forth_count(&forth->stats.user_calls);
+            rstack->frames[rstack->top++] =
+                (forth_frame_t) {ip + ip->skip, ip->node};
+            if (profiled) {
+                forth_profile_enter(forth, ip->node, profiled);
+            }
+            ip = ip->node->code;
+            break;
+        case OP_TAIL_CALL:
+            if (forth_spend_fuel(&fuel)) {
+                goto out_of_fuel;
+            }
+            if (__builtin_expect(ip->node->node_type != TRIE_USERWORD, 0)) {
+                forth->fuel = fuel;
+                forth_execute(forth, ip->node);
+                fuel = forth->fuel;
+                if (forth_failed(forth)) {
+                    goto fail;
+                }
+                ip = &forth_exit;
                 break;
-            case TRIE_USERWORD:
-                forth_eval(forth, node->userword_def);
+            }
+            // reuse the caller's frame, it would only have exited
+            forth_count(&forth->stats.user_calls);
+            if (profiled) {
+                if (rstack->frames[rstack->top - 1].word != NULL) {
+                    forth_profile_exit(forth, profiled);
+                }
+                forth_profile_enter(forth, ip->node, profiled);
+            }
+            rstack->frames[rstack->top - 1].word = ip->node;
+            ip = ip->node->code;
+            break;
+        case OP_EXIT: {
+            forth_frame_t frame = rstack->frames[--rstack->top];
+            if (profiled && frame.word != NULL) {
+                forth_profile_exit(forth, profiled);
+            }
+            if (rstack->top == base) {
+                // what the last instructions pushed or popped may not have
+                // fit
+                if (forth_failed(forth)) {
+                    goto fail;
+                }
+
+                // a spawned task finishes where it started, the interpreter
+                // or a nested run returns
+                if (base > 0 || forth->task == 0) {
+                    forth->fuel = fuel;
+                    return;
+                }
+                ip = task_finish(forth);
                 break;
-            case TRIE_BUILTIN:
-                node->builtin_fn(forth, &i, words, words_length);
+            }
+            ip = frame.ip;
+            break;
+        }
+        case OP_BRANCH:
+            if (ip->offset <= 0 && forth_spend_fuel(&fuel)) {
+                goto out_of_fuel;
+            }
+            ip += ip->offset;
+            break;
+        case OP_0BRANCH: {
+            if (ip->offset <= 0 && forth_spend_fuel(&fuel)) {
+                goto out_of_fuel;
+            }
+            int64_t flag = stack_pop(data).int64;
+            // an empty stack would otherwise spin on the flag it gives
+            if (forth_failed(forth)) {
+                goto fail;
+            }
+            ip += flag == 0 ? ip->offset : 1;
+            break;
+        }
+        case OP_QDO:
+        case OP_DO: {
+            int64_t index = stack_pop(data).int64;
+            int64_t limit = stack_pop(data).int64;
+            if (forth_failed(forth)) {
+                goto fail;
+            }
+            if (ip->op == OP_QDO && index == limit) {
+                ip += ip->offset;
                 break;
-            case TRIE_VARIABLE:
-                stack_push(&forth->data_stack, node->var);
+            }
+            if (forth->loop_top == forth->loop_size) {
+                forth->loop_size *= 2;
+                forth->loops = realloc(forth->loops, sizeof(forth_loop_t) *
+                                                         forth->loop_size);
+            }
+            forth->loops[forth->loop_top++] =
+                (forth_loop_t) {index, limit, ip + ip->offset};
+            ip++;
+            break;
+        }
+        case OP_LOOP: {
+            if (forth_spend_fuel(&fuel)) {
+                goto out_of_fuel;
+            }
+            forth_loop_t *loop = &forth->loops[forth->loop_top - 1];
+            if (++loop->index < loop->limit) {
+                ip += ip->offset;
+            } else {
+                forth->loop_top--;
+                ip++;
+            }
+            break;
+        }
+        case OP_PLUS_LOOP: {
+            if (forth_spend_fuel(&fuel)) {
+                goto out_of_fuel;
+            }
+            forth_loop_t *loop = &forth->loops[forth->loop_top - 1];
+            int64_t inc = stack_pop(data).int64;
+            if (forth_failed(forth)) {
+                goto fail;
+            }
+            int64_t index = loop->index += inc;
+            if ((inc > 0 && index < loop->limit) ||
+                (inc < 0 && index > loop->limit)) {
+                ip += ip->offset;
+            } else {
+                forth->loop_top--;
+                ip++;
+            }
+            break;
+        }
+        case OP_MINUS_LOOP: {
+            if (forth_spend_fuel(&fuel)) {
+                goto out_of_fuel;
+            }
+            forth_loop_t *loop = &forth->loops[forth->loop_top - 1];
+            int64_t dec = stack_pop(data).int64;
+            if (forth_failed(forth)) {
+                goto fail;
+            }
+            int64_t index = loop->index -= dec;
+            if ((dec > 0 && index > loop->limit) ||
+                (dec < 0 && index < loop->limit)) {
+                ip += ip->offset;
+            } else {
+                forth->loop_top--;
+                ip++;
+            }
+            break;
+        }
+        case OP_LEAVE:
+            ip = forth->loops[--forth->loop_top].leave;
+            break;
+        case OP_UNLOOP:
+            // loops under loop_base belong to whoever started this run
+            if (forth->loop_top <= loop_base) {
+                forth_throw(forth, FORTH_THROW_CONTROL_MISMATCH,
+                            "'unloop' outside a loop");
+                goto fail;
+            }
+            forth->loop_top--;
+            ip++;
+            break;
+        case OP_I:
+            stack_push(data,
+                       forth_i64(forth->loops[forth->loop_top - 1].index));
+            ip++;
+            break;
+        case OP_J:
+            // slot 0 is never a loop, so two frames take three slots
+            if (forth->loop_top < 3) {
+                forth_throw(forth, FORTH_THROW_CONTROL_MISMATCH,
+                            "'j' outside a nested loop");
+                goto fail;
+            }
+            stack_push(data,
+                       forth_i64(forth->loops[forth->loop_top - 2].index));
+            ip++;
+            break;
+        case OP_PAR_DO:
+            forth->fuel = fuel;
+            par_do(forth, ip);
+            fuel = forth->fuel;
+            if (forth_failed(forth)) {
+                goto fail;
+            }
+            ip += ip->offset;
+            break;
+        case OP_PAR_SUM:
+        case OP_PAR_MIN:
+        case OP_PAR_MAX:
+            par_fold(forth->fold, ip->op, stack_pop(data));
+            // fall through
+        case OP_PAR_LOOP: {
+            // only reached inside a chunk, see par_run_chunk
+            if (forth_spend_fuel(&fuel)) {
+                goto out_of_fuel;
+            }
+            forth_loop_t *loop = &forth->loops[forth->loop_top - 1];
+            if (++loop->index < loop->limit) {
+                ip += ip->offset;
+            } else {
+                forth->loop_top--;
+                ip = &forth_exit;
+            }
+            break;
+        }
+        case OP_PAUSE:
+            // only the outermost run can leave a task, a nested one would
+            // have to unwind the C stack
+            ip = base == 0 ? task_switch(forth, ip + 1) : ip + 1;
+            break;
+        case OP_SPAWN:
+            if (par_capture != NULL) {
+                forth_throw(forth, FORTH_THROW_UNSUPPORTED,
+                            "task-spawn inside par-do");
+                goto fail;
+            } else {
+                stack_push(data, forth_i64(task_spawn(forth, ip->node)));
+            }
+            ip++;
+            break;
+        case OP_JOIN:
+            ip = task_join(forth, ip, base > 0);
+            if (forth_failed(forth)) {
+                goto fail;
+            }
+            break;
+        case OP_AWAIT:
+            ip = aio_await(forth, ip, base > 0);
+            if (forth_failed(forth)) {
+                goto fail;
+            }
+            break;
+        case OP_PRINT:
+            FORTH_OUTPUT("%s", ip->string);
+            ip++;
+            break;
+        case OP_FETCH:
+            stack_push(data, *(forth_type_t *) (forth->heap + ip->literal.ref));
+            ip++;
+            break;
+        case OP_STORE:
+            *(forth_type_t *) (forth->heap + ip->literal.ref) = stack_pop(data);
+            ip++;
+            break;
+        case OP_PARAM:
+            stack_push(data, forth->params[ip->offset]);
+            ip++;
+            break;
+        }
+    }
+
+out_of_fuel:
+    // only the outermost run can stop and go on later, a nested one has C
+    // frames under it. the instruction at ip runs again on resume
+    forth->fuel = fuel;
+    if (base == 0 && par_capture == NULL) {
+        forth->suspended.ip = ip;
+        forth->suspended.loop_base = loop_base;
+        forth->suspended.profiled = profiled;
+        return;
+    }
+    forth_throw(forth, FORTH_THROW_OUT_OF_FUEL, "out of fuel");
+    goto fail;
+
+overflow:
+    // a data stack that filled up on the way down is what really went wrong
+    forth_check(forth);
+    forth_throw(forth, FORTH_THROW_RSTACK_OVERFLOW, "return stack overflow");
+
+fail:
+    // unwinds to where this run started, a catch further out takes it from
+    // there
+    forth->fuel = fuel;
+    forth_check(forth);
+    while (rstack->top > base) {
+        forth_frame_t frame = rstack->frames[--rstack->top];
+        if (profiled && frame.word != NULL) {
+            forth_profile_exit(forth, profiled);
+        }
+    }
+    forth->loop_top = loop_base;
+    if (base == 0 && forth->task != 0) {
+        // only the task that threw ends
+        ip = task_fail(forth);
+        goto resume;
+    }
+}
+
+// the loop is specialized so running without a profiler pays nothing for it
+static void forth_run_plain(forth_t *forth, const forth_instr_t *ip,
+                            trie_node_t *word) {
+    forth_run_code(forth, ip, word, 0);
+}
+
+static void forth_run_profiled(forth_t *forth, const forth_instr_t *ip,
+                               trie_node_t *word) {
+    forth_run_code(forth, ip, word, forth->profiling);
+}
+
+static void forth_run(forth_t *forth, const forth_instr_t *ip,
+                      trie_node_t *word) {
+    if (forth->profiling) {
+        forth_run_profiled(forth, ip, word);
+    } else {
+        forth_run_plain(forth, ip, word);
+    }
+}
+
+// FUEL
+
+void forth_set_fuel(forth_t *forth, int64_t fuel) {
+    forth->fuel = fuel;
+}
+
+int64_t forth_get_fuel(forth_t *forth) {
+    return forth->fuel < 0 ? 0 : forth->fuel;
+}
+
+// drops a suspended run. a task it stopped in goes on the next time tasks
+// get to run
+static void forth_abandon(forth_t *forth) {
+    forth_suspended_t *suspended = &forth->suspended;
+    if (suspended->ip == NULL) {
+        return;
+    }
+
+    if (forth->task != 0) {
+        task_switch_to(forth, suspended->ip, 0);
+    }
+    forth_rstack_t *rstack = &forth->return_stack;
+    while (rstack->top > 0) {
+        forth_frame_t frame = rstack->frames[--rstack->top];
+        if (suspended->profiled && frame.word != NULL) {
+            forth_profile_exit(forth, suspended->profiled);
+        }
+    }
+    forth->loop_top = suspended->loop_base;
+    forth_abort_compile(forth);
+
+    if (suspended->params != NULL) {
+        forth->params = suspended->outer_params;
+        free(suspended->params);
+    }
+    trie_free_code(suspended->code, suspended->code_length);
+    free(suspended->text);
+    memset(suspended, 0, sizeof(*suspended));
+}
+
+// keeps the input after the word that ran out of fuel. an include stops
+// first and the text around it is added after
+static void forth_suspend_text(forth_t *forth, const forth_source_t *src) {
+    forth_suspended_t *suspended = &forth->suspended;
+    size_t rest = src->length - src->offset;
+    size_t kept = suspended->text ? strlen(suspended->text) : 0;
+
+    suspended->text = realloc(suspended->text, kept + rest + 2);
+    if (kept > 0) {
+        suspended->text[kept++] = '\n';
+    }
+    memcpy(suspended->text + kept, src->text + src->offset, rest);
+    suspended->text[kept + rest] = '\0';
+}
+
+int forth_resume(forth_t *forth) {
+    forth_suspended_t *suspended = &forth->suspended;
+    if (suspended->ip == NULL) {
+        return 0;
+    }
+
+    if (suspended->profiled) {
+        forth_run_profiled(forth, NULL, NULL);
+    } else {
+        forth_run_plain(forth, NULL, NULL);
+    }
+    if (suspended->ip != NULL) {
+        return FORTH_SUSPENDED;
+    }
+
+    if (suspended->params != NULL) {
+        forth->params = suspended->outer_params;
+        free(suspended->params);
+        suspended->params = NULL;
+    }
+    trie_free_code(suspended->code, suspended->code_length);
+    suspended->code = NULL;
+    suspended->code_length = 0;
+    char *text = suspended->text;
+    suspended->text = NULL;
+
+    int code = forth_eval_finish(forth, 0);
+    if (code == 0 && text != NULL) {
+        code = forth_eval(forth, text);
+    }
+    free(text);
+    return code;
+}
+
+void forth_run_tasks(forth_t *forth) {
+    // from inside a running word there would be no switching to them
+    if (forth->return_stack.top > 0) {
+        return;
+    }
+    while (task_pending(forth) && forth->suspended.ip == NULL) {
+        forth_run(forth, task_pause_code, NULL);
+    }
+}
+
+// OUTER INTERPRETER
+
+static void forth_execute(forth_t *forth, trie_node_t *node) {
+    switch (node->node_type) {
+    case TRIE_NONE:
+        forth_throw(forth, FORTH_THROW_UNDEFINED_WORD,
+                    "word '%s' defined with no node type", node->name);
+        break;
+    case TRIE_FFI_FN:
+    case TRIE_BUILTIN: {
+        // sampled once so a word that toggles profiling stays balanced
+        int profiled = forth->profiling;
+        if (profiled) {
+            forth_profile_enter(forth, node, profiled);
+        }
+        forth_count(&forth->stats.builtin_calls);
+        if (node->node_type == TRIE_FFI_FN) {
+            forth_count(&forth->stats.ffi_calls);
+            node->ffi_fn(forth);
+        } else {
+            node->builtin_fn(forth);
+        }
+        if (profiled) {
+            forth_profile_exit(forth, profiled);
+        }
+        break;
+    }
+    case TRIE_USERWORD:
+        forth_count(&forth->stats.user_calls);
+        forth_run(forth, node->code, node);
+        break;
+    case TRIE_VARIABLE:
+        stack_push(&forth->data_stack, node->var);
+        break;
+    case TRIE_VALUE:
+        stack_push(&forth->data_stack,
+                   *(forth_type_t *) (forth->heap + node->var.ref));
+        break;
+    }
+}
+
+static void forth_run_anonymous(forth_t *forth) {
+    size_t length;
+    forth_instr_t *code = forth_finish_code(forth, &length);
+    forth_run(forth, code, NULL);
+    if (forth->suspended.ip != NULL) {
+        forth->suspended.code = code;
+        forth->suspended.code_length = length;
+        return;
+    }
+    trie_free_code(code, length);
+}
+
+// rec, when set, gets the instruction that replays what the word did
+static int forth_interpret(forth_t *forth, const char *word,
+                           forth_snippet_t *rec) {
+    int64_t i64_val;
+    double f64_val;
+    forth_type_t literal;
+
+    if (rec != NULL && (forth->state->int64 || forth->anonymous)) {
+        rec->failed = 1;
+    }
+
+    // outside base 10 names like add or dead are also numbers, the
+    // dictionary wins then
+    unsigned base = forth_base(forth);
+    trie_node_t *node = base == 10 ? NULL : trie_search(forth->root, word);
+
+    if (node == NULL && parse_integer(word, base, &i64_val)) {
+        literal = forth_i64(i64_val);
+    } else if (node == NULL && parse_float(word, &f64_val)) {
+        literal = forth_f64(f64_val);
+    } else {
+        if (node == NULL) {
+            node = trie_search(forth->root, word);
+        }
+        if (node == NULL) {
+            forth_throw(forth, FORTH_THROW_UNDEFINED_WORD,
+                        "word '%s' undefined", word);
+            forth_abort_compile(forth);
+            return 0;
+        }
+
+        // words that parse, compile or define can't simply be replayed
+        if (rec != NULL && (node->flags & FORTH_WORD_IMMEDIATE)) {
+            rec->failed = 1;
+        }
+
+        int compiling = forth->state->int64 != 0;
+        if (compiling && !(node->flags & FORTH_WORD_IMMEDIATE)) {
+            forth_compile_node(forth, node);
+            return 1;
+        }
+
+        if (!compiling && (node->flags & FORTH_WORD_COMPILE_ONLY)) {
+            // between [ and ] the definition's code is still being built
+            if (forth->defining) {
+                forth_throw(forth, FORTH_THROW_COMPILE_ONLY,
+                            "word '%s' is compile only", word);
+                forth_abort_compile(forth);
+                return 0;
+            }
+
+            forth_begin_anonymous(forth);
+            forth_execute(forth, node);
+            if (forth->state->int64 &&
+                forth->control_stack.top == forth->compile_base) {
+                forth_throw(forth, FORTH_THROW_COMPILE_ONLY,
+                            "word '%s' is compile only", word);
+                forth_abort_compile(forth);
+            }
+            return !forth_check(forth);
+        }
+
+        size_t offset = forth->source->offset;
+        if (rec != NULL) {
+            cache_record_node(rec, node);
+        }
+
+        forth_execute(forth, node);
+        if (rec != NULL &&
+            (forth->source->offset != offset || forth->state->int64 ||
+             forth->defining || forth->anonymous)) {
+            rec->failed = 1;
+        }
+        return !forth_check(forth);
+    }
+
+    if (rec != NULL) {
+        cache_record(rec,
+                     (forth_instr_t) {.op = OP_LITERAL, .literal = literal});
+    }
+    if (forth->state->int64) {
+        forth_compile(forth,
+                      (forth_instr_t) {.op = OP_LITERAL, .literal = literal});
+    } else {
+        stack_push(&forth->data_stack, literal);
+    }
+    return !forth_check(forth);
+}
+
+// short text evaluated at the prompt with nothing running is compiled the
+// first time and the code replayed for the same text after that
+static int forth_eval_cacheable(forth_t *forth, size_t length) {
+    return FORTH_EVAL_CACHE_SIZE > 0 && length > 0 &&
+           length <= CACHE_MAX_TEXT && forth->source == NULL &&
+           forth->return_stack.top == 0 && !forth->state->int64 &&
+           !forth->defining && par_capture == NULL &&
+           forth_base(forth) == 10;
+}
+
+// text evaluated from inside a word or an include passes its throw on to
+// the code around it, the outermost evaluation returns it
+static int forth_eval_finish(forth_t *forth, int nested) {
+    int code = forth_check(forth);
+    if (code && !nested) {
+        // like abort, the stack is emptied and a definition the error cut
+        // short is dropped
+        forth->data_stack.top = 0;
+        forth_abort_compile(forth);
+        forth->error = 0;
+    }
+    return code;
+}
+
+static int forth_eval_text(forth_t *forth, const char *code) {
+    size_t length = strlen(code);
+    forth_snippet_t recording = {0};
+    forth_snippet_t *rec = NULL;
+    uint64_t hash = 0;
+    int nested = forth->source != NULL || forth->return_stack.top > 0;
+
+    if (forth_eval_cacheable(forth, length)) {
+        if (forth->cache == NULL) {
+            forth->cache = cache_create();
+        }
+        hash = cache_hash(code, length);
+        forth_snippet_t *snippet =
+            cache_lookup(forth->cache, code, length, hash);
+        if (snippet != NULL) {
+            forth_run(forth, snippet->code, NULL);
+            if (forth->suspended.ip != NULL) {
+                return FORTH_SUSPENDED;
+            }
+            return forth_eval_finish(forth, nested);
+        }
+        rec = &recording;
+    }
+
+    forth_source_t source = {code, length, 0, ++forth->sources};
+    forth_source_t *outer = forth->source;
+    forth->source = &source;
+
+    char word[MAX_WORD_LENGTH];
+    while (forth_parse_name(forth, word, sizeof(word)) > 0) {
+        if (!forth_interpret(forth, word, rec)) {
+            break;
+        }
+
+        if (forth->anonymous &&
+            forth->control_stack.top == forth->compile_base) {
+            forth_run_anonymous(forth);
+            if (forth_check(forth)) {
                 break;
             }
         }
+
+        if (forth->suspended.ip != NULL) {
+            forth_suspend_text(forth, &source);
+            break;
+        }
+    }
+
+    if (rec != NULL && !rec->failed && !forth->error &&
+        !forth->state->int64 && forth->suspended.ip == NULL) {
+        cache_insert(forth->cache, rec, code, length, hash);
+    } else if (rec != NULL) {
+        cache_free_snippet(rec);
+    }
+
+    forth->source = outer;
+    if (forth->suspended.ip != NULL) {
+        return FORTH_SUSPENDED;
     }
+    return forth_eval_finish(forth, nested);
+}
 
-    for (size_t i = 0; i < words_length; i++) {
-        free(words[i]);
+// only the outermost evaluation is timed, nested ones are part of it
+int forth_eval(forth_t *forth, const char *code) {
+    forth_abandon(forth);
+    if (forth->source != NULL || forth->return_stack.top > 0) {
+        return forth_eval_text(forth, code);
     }
-    free(words);
-}
\ No newline at end of file
+
+    uint64_t start = profile_now_ns();
+    int result = forth_eval_text(forth, code);
+    forth->stats.eval_ns += profile_now_ns() - start;
+    forth->stats.evals++;
+    return result;
+}
+
+void forth_eval_cache_stats(forth_t *forth, uint64_t *hits,
+                            uint64_t *misses) {
+    *hits = forth->cache ? forth->cache->hits : 0;
+    *misses = forth->cache ? forth->cache->misses : 0;
+}
+
+// PREPARED PROGRAMS
+
+static int64_t forth_program_slot(forth_program_t *program, const char *name) {
+    for (size_t n = 0; n < program->param_count; n++) {
+        if (strcmp(program->params[n], name) == 0) {
+            return (int64_t) n;
+        }
+    }
+    program->params = realloc(program->params,
+                              sizeof(char *) * (program->param_count + 1));
+    program->params[program->param_count] = strdup(name);
+    return (int64_t) program->param_count++;
+}
+
+void forth_program_free(forth_program_t *program) {
+    if (program == NULL) {
+        return;
+    }
+    trie_free_code(program->code, program->length);
+    for (size_t n = 0; n < program->param_count; n++) {
+        free(program->params[n]);
+    }
+    free(program->params);
+    free(program);
+}
+
+// compiles code the way the body of a definition is compiled, NULL if it
+// doesn't compile, forth_error_message says why
+forth_program_t *forth_prepare(forth_t *forth, const char *code) {
+    if (forth->state->int64 || forth->defining) {
+        forth_throw(forth, FORTH_THROW_NESTED_COMPILE,
+                    "can't prepare while compiling");
+        forth->error = 0;
+        return NULL;
+    }
+
+    forth_program_t *program = calloc(1, sizeof(forth_program_t));
+    program->owner = forth;
+    forth_source_t source = {code, strlen(code), 0, ++forth->sources};
+    forth_source_t *outer = forth->source;
+    forth->source = &source;
+    forth_begin_compile(forth);
+
+    int ok = 1;
+    char word[MAX_WORD_LENGTH];
+    while (ok && forth_parse_name(forth, word, sizeof(word)) > 0) {
+        if (word[0] == '$' && word[1] != '\0' && forth->state->int64) {
+            int64_t slot = forth_program_slot(program, word + 1);
+            forth_compile(forth,
+                          (forth_instr_t) {.op = OP_PARAM, .offset = slot});
+            continue;
+        }
+        ok = forth_interpret(forth, word, NULL) && !forth->defining;
+    }
+
+    if (ok && (!forth->state->int64 ||
+               forth->control_stack.top != forth->compile_base)) {
+        forth_throw(forth, FORTH_THROW_CONTROL_MISMATCH,
+                    "unfinished program '%s'", code);
+        ok = 0;
+    }
+
+    if (ok) {
+        program->code = forth_finish_code(forth, &program->length);
+    } else {
+        forth_abort_compile(forth);
+        forth_program_free(program);
+        program = NULL;
+    }
+
+    forth->error = 0;
+    forth->source = outer;
+    return program;
+}
+
+// index into the params given to forth_program_run, -1 if the program
+// doesn't use name
+int forth_program_param(const forth_program_t *program, const char *name) {
+    for (size_t n = 0; n < program->param_count; n++) {
+        if (strcmp(program->params[n], name) == 0) {
+            return (int) n;
+        }
+    }
+    return -1;
+}
+
+// params holds a value for each parameter, returns the throw code that
+// ended the run, 0 if none. only the instance that prepared the program
+// can run it
+int forth_program_run(forth_t *forth, const forth_program_t *program,
+                      const forth_type_t *params) {
+    forth_abandon(forth);
+
+    int nested = forth->source != NULL || forth->return_stack.top > 0;
+    if (program->owner != forth) {
+        forth_throw(forth, FORTH_THROW_INVALID_ARGUMENT,
+                    "program was prepared by another instance");
+        return forth_eval_finish(forth, nested);
+    }
+    if (params == NULL && program->param_count > 0) {
+        forth_throw(forth, FORTH_THROW_INVALID_ARGUMENT,
+                    "program expects %zu parameters", program->param_count);
+        return forth_eval_finish(forth, nested);
+    }
+
+    const forth_type_t *outer = forth->params;
+    forth->params = params;
+    forth_run(forth, program->code, NULL);
+    if (forth->suspended.ip != NULL) {
+        // params are read again when it resumes, the copy lasts until it
+        // ends or is abandoned
+        forth_suspended_t *suspended = &forth->suspended;
+        suspended->params =
+            malloc(sizeof(forth_type_t) * (program->param_count + 1));
+        if (program->param_count > 0) {
+            memcpy(suspended->params, params,
+                   sizeof(forth_type_t) * program->param_count);
+        }
+        suspended->outer_params = outer;
+        forth->params = suspended->params;
+        return FORTH_SUSPENDED;
+    }
+    forth->params = outer;
+    return forth_eval_finish(forth, nested);
+}
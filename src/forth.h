@@ -4,14 +4,84 @@
 #include <stdint.h>
 #include <string.h>
 
-#ifndef MAX_WORD_DEFINITION_SIZE
-// maximum length of user word definitions
-#define MAX_WORD_DEFINITION_SIZE 8192
+#ifndef MAX_WORD_LENGTH
+// maximum length of a single word, longer words are truncated
+#define MAX_WORD_LENGTH 256
 #endif
 
-#ifndef MAX_TOKENS
-// maximum number of tokens that can be tokenized at once
-#define MAX_TOKENS 8192
+#ifndef MAX_RETURN_DEPTH
+// maximum number of nested calls, the return stack grows up to this
+#define MAX_RETURN_DEPTH (1 << 20)
+#endif
+
+#ifndef FORTH_INLINE_THRESHOLD
+// user words of at most this many instructions are copied into their
+// callers instead of called, 0 turns inlining off
+#define FORTH_INLINE_THRESHOLD 12
+#endif
+
+#ifndef FORTH_PAR_THREADS
+// threads used by par-do loops, 0 uses one per online cpu
+#define FORTH_PAR_THREADS 0
+#endif
+
+#ifndef FORTH_TASK_STACK_SIZE
+// bytes of data and control stack given to each task
+#define FORTH_TASK_STACK_SIZE 4096
+#endif
+
+#ifndef FORTH_EVAL_CACHE_SIZE
+// short snippets forth_eval keeps compiled, 0 turns the cache off
+#define FORTH_EVAL_CACHE_SIZE 64
+#endif
+
+#ifndef FORTH_STATS
+// count the calls forth_get_stats reports, 0 leaves them out of the inner
+// interpreter
+#define FORTH_STATS 1
+#endif
+
+#ifndef FORTH_AIO_DEPTH
+// file reads and writes that can be in flight at once
+#define FORTH_AIO_DEPTH 64
+#endif
+
+#ifndef FORTH_AIO_URING
+// submit file requests through io_uring, 0 always uses the thread pool
+#define FORTH_AIO_URING 1
+#endif
+
+#ifndef FORTH_ERROR_MESSAGE_SIZE
+// bytes kept of the message that goes with a throw
+#define FORTH_ERROR_MESSAGE_SIZE 256
+#endif
+
+#ifndef FORTH_HOLD_SIZE
+// bytes of the area pictured numeric output is built in, a double cell
+// in base 2 takes 129
+#define FORTH_HOLD_SIZE 256
+#endif
+
+#ifndef FORTH_TRANSIENT_SIZE
+// bytes of the area s" keeps strings in while interpreting, each one lasts
+// until the strings after it have wrapped around to it
+#define FORTH_TRANSIENT_SIZE 4096
+#endif
+
+#ifndef FORTH_RANDOM_SEED
+// seed every instance's random numbers start from, seed picks another
+#define FORTH_RANDOM_SEED 0
+#endif
+
+#ifndef FORTH_FUEL_UNLIMITED
+// fuel of an instance that should never run out
+#define FORTH_FUEL_UNLIMITED INT64_MAX
+#endif
+
+#ifndef FORTH_SEGMENT_BITS
+// bits of a reference that are an offset into its segment, the bits above
+// them say which segment
+#define FORTH_SEGMENT_BITS 40
 #endif
 
 #ifndef FORTH_ERROR_FUNCTION
@@ -47,41 +117,318 @@ typedef struct {
     forth_type_t *data;
     int64_t size;
     int64_t top;
+    int64_t fault; // throw code of a push or pop that didn't fit, 0 if none
 } forth_stack_t;
 
+// throw codes from the standard, others are the program's own
+enum FORTH_THROW_CODE {
+    FORTH_THROW_ABORT = -1,
+    FORTH_THROW_STACK_OVERFLOW = -3,
+    FORTH_THROW_STACK_UNDERFLOW = -4,
+    FORTH_THROW_RSTACK_OVERFLOW = -5,
+    FORTH_THROW_RSTACK_UNDERFLOW = -6,
+    FORTH_THROW_HEAP_FULL = -8, // dictionary overflow in the standard
+    FORTH_THROW_INVALID_ADDRESS = -9,
+    FORTH_THROW_DIVISION_BY_ZERO = -10,
+    FORTH_THROW_OUT_OF_RANGE = -11,
+    FORTH_THROW_UNDEFINED_WORD = -13,
+    FORTH_THROW_COMPILE_ONLY = -14,
+    FORTH_THROW_NO_NAME = -16,
+    FORTH_THROW_HOLD_OVERFLOW = -17,
+    FORTH_THROW_STRING_OVERFLOW = -18,
+    FORTH_THROW_UNSUPPORTED = -21,
+    FORTH_THROW_CONTROL_MISMATCH = -22,
+    FORTH_THROW_INVALID_ARGUMENT = -24,
+    FORTH_THROW_NESTED_COMPILE = -29,
+    FORTH_THROW_INVALID_NAME = -32,
+    FORTH_THROW_FILE_IO = -37,
+    FORTH_THROW_NO_FILE = -38,
+
+    // not thrown, returned when the run ran out of fuel and forth_resume
+    // continues it
+    FORTH_SUSPENDED = -256,
+    // ran out of fuel where the run couldn't stop, such as inside catch
+    FORTH_THROW_OUT_OF_FUEL = -257,
+};
+
+// references are a segment number and an offset into it rather than host
+// addresses, so the heap can be copied anywhere without fixing up the cells
+// that point into it. heap references are plain heap offsets
+enum FORTH_SEGMENT {
+    FORTH_SEGMENT_HEAP,
+    FORTH_SEGMENT_HOLD, // pictured numeric output of the instance using it
+    FORTH_SEGMENT_XT,   // execution tokens, the offset indexes forth_t.xts
+    FORTH_SEGMENT_TRANSIENT,    // strings s" made while interpreting
+    FORTH_SEGMENT_FIRST_REGION, // map-file mappings and host regions
+};
+
+// memory outside the heap that references can point into
+typedef struct {
+    uint8_t *base; // NULL once it was removed
+    size_t size;
+    // a map-file mapping, shared with clones and released by the last of
+    // them to let go. NULL for host regions
+    struct forth_mapping_s *mapping;
+} forth_segment_t;
+
+// what an instance did since it was created or its stats were reset, see
+// forth_get_stats
+typedef struct {
+    uint64_t words_executed; // user, builtin and ffi calls together
+    uint64_t user_calls;     // inlined copies count as calls too
+    uint64_t builtin_calls;
+    uint64_t ffi_calls;
+    int64_t data_stack_max; // deepest either stack got, in cells
+    int64_t control_stack_max;
+    size_t heap_used; // next_address
+    size_t heap_peak;
+    size_t heap_size;
+    uint64_t allocations; // allocate calls
+    size_t dictionary_nodes;
+    size_t dictionary_bytes; // nodes, names, code and definition text
+    uint64_t evals;   // outermost forth_eval calls
+    uint64_t eval_ns; // time spent in them
+} forth_stats_t;
+
+// one call on the return stack
+typedef struct {
+    const struct forth_instr_s *ip; // where the caller continues
+    struct trie_node_s *word;       // word being executed
+} forth_frame_t;
+
+typedef struct {
+    forth_frame_t *frames;
+    int64_t size;
+    int64_t top;
+} forth_rstack_t;
+
+// one running do loop
+typedef struct {
+    int64_t index;
+    int64_t limit;
+    const struct forth_instr_s *leave; // where leave continues
+} forth_loop_t;
+
+// text the outer interpreter is reading from
+typedef struct {
+    const char *text;
+    size_t length;
+    size_t offset;
+    uint64_t id;
+} forth_source_t;
+
+// a run that ran out of fuel, kept until forth_resume continues it
 typedef struct {
-    forth_stack_t data_stack;
+    const struct forth_instr_s *ip; // where it stopped, NULL if nothing did
+    int64_t loop_base;
+    int profiled;
+    struct forth_instr_s *code; // code typed outside a definition it runs
+    size_t code_length;
+    char *text; // input that was still to be evaluated
+    // a prepared program's parameters, copied since the caller's array may
+    // be gone by the time it resumes, and the ones to go back to after it
+    forth_type_t *params;
+    const forth_type_t *outer_params;
+} forth_suspended_t;
+
+typedef struct {
+    // the inner interpreter's hot state starts on its own cache line, the
+    // speed of every word otherwise depends on where forth_t happens to land
+    _Alignas(64) forth_stack_t data_stack;
     forth_stack_t control_stack;
+    forth_rstack_t return_stack;
+
+    // slot 0 is never a real loop so the innermost slot always exists
+    forth_loop_t *loops;
+    int64_t loop_size;
+    int64_t loop_top;
+
+    // spent by calls and backward branches, the outermost run stops when
+    // it goes below 0
+    int64_t fuel;
+    forth_suspended_t suspended;
 
     uint8_t *heap;
+    size_t heap_size; // bytes
     size_t next_address;
 
+    // segments from FORTH_SEGMENT_FIRST_REGION on, see forth_addr
+    forth_segment_t *regions;
+    size_t region_count;
+
+    // nodes that were given an execution token, in the order they got one
+    struct trie_node_s **xts;
+    size_t xt_count;
+    size_t xt_capacity;
+
     struct trie_node_s *root;
+    struct trie_block_s *blocks; // what a clone's dictionary was copied into
+
+    // input and compiler state
+    forth_source_t *source;
+    uint64_t sources;
+    forth_type_t *state; // cell behind the state variable, -1 while compiling
+    forth_type_t *base;  // cell behind the base variable
+    int defining;
+    int anonymous;
+    struct trie_node_s *latest;
+    int latest_type;
+    int64_t compile_base;
+    uint64_t def_source;
+    size_t def_start;
+    struct forth_instr_s *code;
+    size_t code_length;
+    size_t code_capacity;
+    struct forth_retired_s *retired;
+
+    // code of recently evaluated snippets, see cache.h
+    struct forth_cache_s *cache;
+
+    // throw code nothing has caught yet, the rest of the input and the code
+    // being run are abandoned while it is set
+    int error;
+    char error_message[FORTH_ERROR_MESSAGE_SIZE];
+
+    // pictured numeric output, <# starts it at the end and hold works
+    // towards the front
+    char hold[FORTH_HOLD_SIZE];
+    size_t hold_start;
+
+    // FORTH_TRANSIENT_SIZE bytes interpreted s" strings are copied into,
+    // starting over at the front once the next one doesn't fit
+    char *transient;
+    size_t transient_next;
+
+    // counted as it runs, forth_get_stats fills in the rest
+    forth_stats_t stats;
+
+    // per-word profilers, see profile.h and sample.h
+    struct forth_profile_s *profile;
+    struct forth_sampler_s *sampler;
+    int profiling;
+
+    // par-do worker pool and the reduction being run, see par.h
+    struct forth_par_s *par;
+    struct forth_par_fold_s *fold;
+
+    // tasks started with task-spawn and the one running, see task.h
+    struct forth_task_s *tasks;
+    int64_t task_count;
+    int64_t task;
+
+    // outstanding read-file-async and write-file-async requests, see aio.h
+    struct forth_aio_s *aio;
+
+    // parameters of the prepared program being run
+    const forth_type_t *params;
+
+    // state behind random, frandom and random-fill, see random.h
+    uint64_t random[4];
 } forth_t;
 
-typedef void (*forth_builtin_ptr)(forth_t *, size_t *, char **, size_t);
+// bits of forth_t.profiling
+#define FORTH_PROFILE_TIMING 1
+#define FORTH_PROFILE_SAMPLING 2
+
+typedef void (*forth_builtin_ptr)(forth_t *);
 typedef void (*forth_ffi_fn_ptr)(forth_t *);
 
+// bits of trie_node_t.flags
+#define FORTH_WORD_IMMEDIATE 1
+#define FORTH_WORD_COMPILE_ONLY 2
+
+enum FORTH_OPCODE {
+    OP_LITERAL,
+    OP_BUILTIN,
+    OP_FFI_FN,
+    OP_CALL,
+    OP_TAIL_CALL,
+    OP_INLINE, // start of an inlined copy of node, checked against version
+    OP_EXIT,
+    OP_BRANCH,
+    OP_0BRANCH,
+    OP_DO,
+    OP_QDO,
+    OP_LOOP,
+    OP_PLUS_LOOP,
+    OP_MINUS_LOOP,
+    OP_LEAVE,
+    OP_UNLOOP,
+    OP_I,
+    OP_J,
+    OP_PAR_DO, // offset is past the closing par-loop
+    OP_PAR_LOOP,
+    OP_PAR_SUM, // par-loop that also folds the value the body left
+    OP_PAR_MIN,
+    OP_PAR_MAX,
+    OP_PAUSE,
+    OP_SPAWN, // start node as a task
+    OP_JOIN,
+    OP_AWAIT,
+    OP_PARAM, // push parameter offset of the prepared program being run
+    OP_PRINT,
+    OP_FETCH, // push the heap cell literal refers to
+    OP_STORE, // pop into the heap cell literal refers to
+};
+
+// one compiled instruction, branch offsets are relative to the instruction
+typedef struct forth_instr_s {
+    enum FORTH_OPCODE op;
+    union {
+        forth_type_t literal;
+        struct {
+            struct trie_node_s *node;
+            union {
+                forth_builtin_ptr fn;
+                struct {
+                    uint32_t version;
+                    int32_t skip;
+                };
+            };
+        };
+        int64_t offset;
+        char *string;
+    };
+} forth_instr_t;
+
 enum TRIE_NODE_TYPE {
     TRIE_NONE,
     TRIE_USERWORD,
     TRIE_BUILTIN,
     TRIE_FFI_FN,
-    TRIE_VARIABLE,
+    TRIE_VARIABLE, // pushes var, a variable's address or a constant's value
+    TRIE_VALUE,    // pushes the cell var points to, changed with to
 };
 
 typedef struct trie_node_s {
     struct trie_node_s *children[ALPHABET_SIZE];
     enum TRIE_NODE_TYPE node_type;
+    int flags;
+    uint32_t version; // bumped on every redefinition
     union {
-        char *userword_def;
         forth_builtin_ptr builtin_fn;
         forth_ffi_fn_ptr ffi_fn;
         forth_type_t var;
+        struct {
+            forth_instr_t *code;
+            size_t code_length;
+        };
     };
+    char *userword_def;
     size_t userword_def_len;
+    char *name;
+    int in_block; // freed with its trie_block_t rather than on its own
+    uint32_t xt;  // 1 + its index in forth_t.xts, 0 before it has one
 } trie_node_t;
 
+#define TRIE_BLOCK_NODES 64
+
+typedef struct trie_block_s {
+    struct trie_block_s *next;
+    size_t used;
+    trie_node_t nodes[TRIE_BLOCK_NODES];
+} trie_block_t;
+
 forth_stack_t stack_init(size_t size);
 void stack_resize(forth_stack_t *stack, size_t size);
 void stack_destroy(forth_stack_t *stack);
@@ -95,11 +442,82 @@ void forth_destroy(forth_t *forth);
 void forth_define_word(forth_t *forth, const char *name,
                        const char *definition);
 const char *forth_lookup_word(forth_t *forth, const char *name);
-void forth_import_file(forth_t *forth, const char *filename);
-void forth_eval(forth_t *forth, const char *code);
+// both return the throw code that ended them, 0 if they ran to the end
+int forth_import_file(forth_t *forth, const char *filename);
+int forth_eval(forth_t *forth, const char *code);
+void forth_eval_cache_stats(forth_t *forth, uint64_t *hits,
+                            uint64_t *misses);
 void forth_add_ffi_function(forth_t *forth, const char *name,
                             void (*ffi_fn)(forth_t *));
 void forth_define_variable(forth_t *forth, const char *name, forth_type_t *val);
+forth_type_t *forth_get_variable(forth_t *forth, const char *name);
+// makes size bytes of host memory addressable from forth and returns the
+// reference to the first one. the memory has to stay valid until the region
+// is removed again
+forth_type_t forth_add_region(forth_t *forth, void *base, size_t size);
+void forth_remove_region(forth_t *forth, forth_type_t ref);
+void *forth_segment_addr(const forth_t *forth, size_t ref, size_t len);
+forth_type_t *forth_get_value(forth_t *forth, const char *name);
+// the c function behind a builtin or ffi function, for calling it directly
+forth_ffi_fn_ptr forth_get_function(forth_t *forth, const char *name);
+
+// text compiled once and run many times, $name in the text is a parameter
+// that is given a value on every run. a program belongs to the instance
+// that prepared it, running it in another throws
+typedef struct forth_program_s forth_program_t;
+forth_program_t *forth_prepare(forth_t *forth, const char *code);
+int forth_program_param(const forth_program_t *program, const char *name);
+int forth_program_run(forth_t *forth, const forth_program_t *program,
+                      const forth_type_t *params);
+void forth_program_free(forth_program_t *program);
+
+// raises a throw with code and a printf style message, the first throw wins
+// until it is caught. the message of the last one stays readable after
+void forth_throw(forth_t *forth, int code, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+const char *forth_error_message(forth_t *forth);
+
+// runs tasks started with task-spawn until all of them have finished
+void forth_run_tasks(forth_t *forth);
+
+// a new instance with its own copy of parent's dictionary, heap and stacks,
+// NULL while parent is running or compiling. forth_destroy it and then free
+// it
+forth_t *forth_clone(const forth_t *parent);
+
+// evaluation returns FORTH_SUSPENDED once fuel runs out, forth_resume
+// continues where it stopped after more fuel is given. evaluating other text
+// instead abandons the suspended run
+void forth_set_fuel(forth_t *forth, int64_t fuel);
+int64_t forth_get_fuel(forth_t *forth);
+int forth_resume(forth_t *forth);
+
+// reading the input source, for words that parse
+size_t forth_parse_name(forth_t *forth, char *buf, size_t size);
+const char *forth_parse(forth_t *forth, char delim, size_t *length);
+
+// compiling, for immediate words
+void forth_compile(forth_t *forth, forth_instr_t instr);
+void forth_begin_definition(forth_t *forth, const char *name);
+void forth_end_definition(forth_t *forth);
+void forth_abort_compile(forth_t *forth);
+
+// counters are always on. stack depths are found by looking for the
+// pattern stacks are filled with, so pushes cost nothing extra
+forth_stats_t forth_get_stats(forth_t *forth);
+void forth_reset_stats(forth_t *forth);
+
+void forth_profile_start(forth_t *forth);
+void forth_profile_stop(forth_t *forth);
+void forth_profile_reset(forth_t *forth);
+void forth_profile_report(forth_t *forth);
+int forth_profile_write_folded(forth_t *forth, const char *filename);
+
+int forth_sample_start(forth_t *forth, unsigned interval_us);
+void forth_sample_stop(forth_t *forth);
+void forth_sample_reset(forth_t *forth);
+void forth_sample_report(forth_t *forth);
+int forth_sample_write_folded(forth_t *forth, const char *filename);
 
 static inline forth_type_t forth_i64(int64_t n) {
     forth_type_t val;
@@ -125,6 +543,49 @@ static inline forth_type_t forth_ref(size_t n) {
     return val;
 }
 
+static inline size_t forth_segment_ref(size_t segment, size_t offset) {
+    return segment << FORTH_SEGMENT_BITS | offset;
+}
+
+// the host address of the len bytes at ref, NULL unless all of them are
+// inside the segment ref points into
+static inline void *forth_addr(const forth_t *forth, size_t ref, size_t len) {
+    if (ref <= forth->heap_size && len <= forth->heap_size - ref) {
+        return forth->heap + ref;
+    }
+    return forth_segment_addr(forth, ref, len);
+}
+
+// turns a push or pop that didn't fit into a throw, returns the code of the
+// pending throw
+static inline int forth_check(forth_t *forth) {
+    if (forth->data_stack.fault) {
+        int code = (int) forth->data_stack.fault;
+        forth->data_stack.fault = 0;
+        forth_throw(forth, code,
+                    code == FORTH_THROW_STACK_UNDERFLOW ? "stack underflow"
+                                                        : "stack overflow");
+    }
+    if (forth->control_stack.fault) {
+        int code = forth->control_stack.fault == FORTH_THROW_STACK_UNDERFLOW
+                       ? FORTH_THROW_RSTACK_UNDERFLOW
+                       : FORTH_THROW_RSTACK_OVERFLOW;
+        forth->control_stack.fault = 0;
+        forth_throw(forth, code,
+                    code == FORTH_THROW_RSTACK_UNDERFLOW
+                        ? "return stack underflow"
+                        : "return stack overflow");
+    }
+    return forth->error;
+}
+
+// radix numbers are read and printed in, 10 when base holds something
+// that isn't one
+static inline unsigned forth_base(const forth_t *forth) {
+    int64_t base = forth->base->int64;
+    return base >= 2 && base <= 36 ? (unsigned) base : 10;
+}
+
 static inline int strequal(const char *str1, const char *str2) {
     return (strcmp(str1, str2) == 0);
 }
\ No newline at end of file
@@ -1,3 +1,4 @@
+#include <errno.h>
 #include <stdio.h>
 
 #include <readline/history.h>
@@ -5,8 +6,11 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "emit.h"
 #include "forth.h"
+#include "serve.h"
 
 // ffi function example
 void ffi_rand(forth_t *forth) {
@@ -14,6 +18,66 @@ void ffi_rand(forth_t *forth) {
     stack_push(&forth->data_stack, forth_i64(n));
 }
 
+// reports a script that failed on stderr, returns the exit status it
+// gives the run
+static int report(forth_t *forth, int code) {
+    if (code == 0) {
+        return 0;
+    }
+    // keep the message after what the script printed before it failed
+    fflush(stdout);
+    fprintf(stderr, "Error: %s\n", forth_error_message(forth));
+    return 1;
+}
+
+// evaluates a stream as it arrives without waiting for the end of it, each
+// chunk cut at its last line break so no word is split. stops at the first
+// error the way a file does
+static int eval_stream(forth_t *forth, int fd) {
+    size_t capacity = 65536;
+    size_t length = 0;
+    char *buf = malloc(capacity + 1);
+    int code = 0;
+
+    for (;;) {
+        ssize_t got = read(fd, buf + length, capacity - length);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        int end = got <= 0;
+        if (got > 0) {
+            length += (size_t) got;
+        }
+
+        size_t cut = length;
+        while (!end && cut > 0 && buf[cut - 1] != '\n') {
+            cut--;
+        }
+        if (cut == 0 && !end) {
+            // a line longer than the buffer
+            if (length == capacity) {
+                capacity *= 2;
+                buf = realloc(buf, capacity + 1);
+            }
+            continue;
+        }
+
+        char kept = buf[cut];
+        buf[cut] = '\0';
+        code = forth_eval(forth, buf);
+        buf[cut] = kept;
+
+        memmove(buf, buf + cut, length - cut);
+        length -= cut;
+        if (code || end) {
+            break;
+        }
+    }
+
+    free(buf);
+    return code;
+}
+
 int main(int argc, char *argv[]) {
     forth_t forth =
         forth_init(sizeof(forth_type_t) * 4096, sizeof(forth_type_t) * 4096);
@@ -24,25 +88,79 @@ int main(int argc, char *argv[]) {
     // handle ^C and ^D in readline
     rl_getc_function = getc;
 
-    if (argc > 1) {
-        for (int i = 1; i < argc; i++) {
-            forth_import_file(&forth, argv[i]);
+    // --serve path keeps serving the loaded files over a socket instead
+    // of starting the prompt
+    const char *serve_path = NULL;
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+
+    // --emit-c path loads path and writes its words out as c instead
+    const char *emit_path = NULL;
+
+    // -e and - run without the prompt, --quiet keeps the prompt's line at a
+    // time evaluation but drops readline, the prompt and " ok"
+    int batch = 0;
+    int quiet = 0;
+    int status = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strequal(argv[i], "--serve") && i + 1 < argc) {
+            serve_path = argv[++i];
+        } else if (strequal(argv[i], "--workers") && i + 1 < argc) {
+            workers = strtol(argv[++i], NULL, 10);
+        } else if (strequal(argv[i], "--emit-c") && i + 1 < argc) {
+            // whatever the file prints would end up in the c
+            emit_path = argv[++i];
+            FILE *saved = stdout;
+            stdout = stderr;
+            status |= report(&forth, forth_import_file(&forth, emit_path));
+            stdout = saved;
+        } else if (strequal(argv[i], "--quiet")) {
+            quiet = 1;
+        } else if (strequal(argv[i], "-e") && i + 1 < argc) {
+            batch = 1;
+            status |= report(&forth, forth_eval(&forth, argv[++i]));
+        } else if (strequal(argv[i], "-")) {
+            batch = 1;
+            status |= report(&forth, eval_stream(&forth, STDIN_FILENO));
+        } else {
+            status |= report(&forth, forth_import_file(&forth, argv[i]));
         }
     }
 
-    while (1) {
-        char *line = readline("meili> ");
-        if (line == NULL) {
-            break;
-        }
+    // let tasks the scripts started but never joined finish
+    forth_run_tasks(&forth);
 
-        add_history(line);
-        forth_eval(&forth, line);
-        printf(" ok\n");
+    if (emit_path != NULL) {
+        if (status == 0) {
+            forth_emit_c(&forth, emit_path, stdout);
+        }
+    } else if (serve_path != NULL) {
+        status = forth_serve(&forth, serve_path,
+                             workers > 0 ? (size_t) workers : 1);
+    } else if (quiet && !batch) {
+        char *line = NULL;
+        size_t size = 0;
+        while (getline(&line, &size, stdin) >= 0) {
+            status |= report(&forth, forth_eval(&forth, line));
+        }
         free(line);
+    } else if (!batch) {
+        while (1) {
+            char *line = readline("meili> ");
+            if (line == NULL) {
+                break;
+            }
+
+            add_history(line);
+            if (forth_eval(&forth, line)) {
+                printf("Error: %s\n", forth_error_message(&forth));
+            }
+            printf(" ok\n");
+            free(line);
+        }
+        rl_clear_history();
     }
 
-    rl_clear_history();
     forth_destroy(&forth);
-    return 0;
-}
\ No newline at end of file
+    return status;
+}
@@ -0,0 +1,426 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "forth.h"
+#include "random.h"
+
+// chunks handed out per thread, more evens out uneven iterations
+#define PAR_CHUNKS_PER_THREAD 8
+
+// running reduction of the values a par-sum, par-min or par-max body leaves
+typedef struct forth_par_fold_s {
+    forth_type_t value;
+    int empty;
+} forth_par_fold_t;
+
+// a contiguous range of iterations, output is kept per chunk and printed in
+// chunk order once the whole loop is done
+typedef struct {
+    int64_t start;
+    int64_t end;
+    forth_par_fold_t fold;
+    // random numbers of the chunk's iterations, whichever worker runs it
+    uint64_t random[4];
+
+    char *output;
+    size_t length;
+    size_t capacity;
+} forth_par_chunk_t;
+
+typedef struct forth_par_s {
+    // workers[0] belongs to the thread that runs the par-do
+    forth_t *workers;
+    pthread_t *threads;
+    size_t count;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    uint64_t generation;
+    size_t running;
+    int quit;
+
+    // the loop being run
+    forth_t *parent;
+    const struct forth_instr_s *body;
+    forth_par_chunk_t *chunks;
+    size_t chunk_count;
+    atomic_size_t next;
+    atomic_int failed; // throw code of the first chunk that threw
+    // fuel the parent had left, each chunk takes what it burned out of it
+    _Atomic int64_t fuel;
+    char message[FORTH_ERROR_MESSAGE_SIZE];
+} forth_par_t;
+
+// chunk the current thread is running, NULL outside par-do
+static _Thread_local forth_par_chunk_t *par_capture = NULL;
+
+static void forth_run(forth_t *forth, const struct forth_instr_s *ip,
+                      trie_node_t *word);
+
+static void par_vprintf(forth_par_chunk_t *chunk, const char *fmt,
+                        va_list args) {
+    va_list copy;
+    va_copy(copy, args);
+    int len = vsnprintf(NULL, 0, fmt, copy);
+    va_end(copy);
+    if (len <= 0) {
+        return;
+    }
+
+    if (chunk->length + (size_t) len + 1 > chunk->capacity) {
+        size_t capacity = chunk->capacity ? chunk->capacity : 64;
+        while (chunk->length + (size_t) len + 1 > capacity) {
+            capacity *= 2;
+        }
+        chunk->output = realloc(chunk->output, capacity);
+        chunk->capacity = capacity;
+    }
+
+    vsnprintf(chunk->output + chunk->length, (size_t) len + 1, fmt, args);
+    chunk->length += (size_t) len;
+}
+
+static void par_printf(forth_par_chunk_t *chunk, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    par_vprintf(chunk, fmt, args);
+    va_end(args);
+}
+
+// output of words, buffered while running a par-do chunk
+#define FORTH_OUTPUT(...)                                                      \
+    do {                                                                       \
+        if (par_capture != NULL) {                                             \
+            par_printf(par_capture, __VA_ARGS__);                              \
+        } else {                                                               \
+            FORTH_OUTPUT_FUNCTION(__VA_ARGS__);                                \
+        }                                                                      \
+    } while (0)
+
+static void par_fold(forth_par_fold_t *fold, enum FORTH_OPCODE op,
+                     forth_type_t value) {
+    if (fold->empty) {
+        fold->value = value;
+        fold->empty = 0;
+        return;
+    }
+
+    forth_type_t acc = fold->value;
+    if (acc.tag == FORTH_F64 || value.tag == FORTH_F64) {
+        double a = acc.tag == FORTH_F64 ? acc.float64 : (double) acc.int64;
+        double b =
+            value.tag == FORTH_F64 ? value.float64 : (double) value.int64;
+        if (op == OP_PAR_SUM) {
+            fold->value = forth_f64(a + b);
+        } else if ((op == OP_PAR_MIN && b < a) || (op == OP_PAR_MAX && b > a)) {
+            fold->value = value;
+        }
+        return;
+    }
+
+    if (op == OP_PAR_SUM) {
+        fold->value.int64 += value.int64;
+    } else if ((op == OP_PAR_MIN && value.int64 < acc.int64) ||
+               (op == OP_PAR_MAX && value.int64 > acc.int64)) {
+        fold->value = value;
+    }
+}
+
+// runs iterations [start, end) of the body right after a par-do
+static void par_run_chunk(forth_t *forth, const struct forth_instr_s *body,
+                          int64_t start, int64_t end, forth_par_fold_t *fold) {
+    if (forth->loop_top == forth->loop_size) {
+        forth->loop_size *= 2;
+        forth->loops =
+            realloc(forth->loops, sizeof(forth_loop_t) * forth->loop_size);
+    }
+    int64_t loop_top = forth->loop_top;
+    forth->loops[forth->loop_top++] = (forth_loop_t) {start, end, NULL};
+
+    forth_par_fold_t *outer = forth->fold;
+    forth->fold = fold;
+    forth_run(forth, body, NULL);
+    forth->fold = outer;
+
+    // an exit inside the body ends the chunk early
+    forth->loop_top = loop_top;
+}
+
+static void par_copy_stack(forth_stack_t *to, const forth_stack_t *from) {
+    memcpy(to->data, from->data, sizeof(forth_type_t) * from->top);
+    to->top = from->top;
+}
+
+// every chunk starts from the stacks and loops of the thread running par-do
+static void par_reset_worker(forth_t *worker, const forth_t *parent) {
+    par_copy_stack(&worker->data_stack, &parent->data_stack);
+    par_copy_stack(&worker->control_stack, &parent->control_stack);
+
+    if (worker->loop_size <= parent->loop_top) {
+        worker->loop_size = parent->loop_size;
+        worker->loops =
+            realloc(worker->loops, sizeof(forth_loop_t) * worker->loop_size);
+    }
+    memcpy(worker->loops, parent->loops,
+           sizeof(forth_loop_t) * parent->loop_top);
+    worker->loop_top = parent->loop_top;
+}
+
+static void par_work(forth_par_t *par, forth_t *worker) {
+    while (!atomic_load(&par->failed)) {
+        size_t idx = atomic_fetch_add(&par->next, 1);
+        if (idx >= par->chunk_count) {
+            break;
+        }
+
+        forth_par_chunk_t *chunk = &par->chunks[idx];
+        par_reset_worker(worker, par->parent);
+
+        // a chunk runs out when it alone would burn more than is left
+        int64_t fuel = atomic_load(&par->fuel);
+        worker->fuel = fuel;
+        memcpy(worker->random, chunk->random, sizeof(worker->random));
+        par_capture = chunk;
+        par_run_chunk(worker, par->body, chunk->start, chunk->end,
+                      &chunk->fold);
+        par_capture = NULL;
+        atomic_fetch_sub(&par->fuel, fuel - worker->fuel);
+
+        // the first chunk to throw ends the loop, the rest are skipped
+        if (forth_check(worker)) {
+            int expected = 0;
+            if (atomic_compare_exchange_strong(&par->failed, &expected,
+                                               worker->error)) {
+                memcpy(par->message, worker->error_message,
+                       sizeof(par->message));
+            }
+            worker->error = 0;
+        }
+    }
+}
+
+static void *par_thread(void *arg) {
+    forth_t *worker = arg;
+    forth_par_t *par = worker->par;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&par->lock);
+    for (;;) {
+        while (par->generation == seen && !par->quit) {
+            pthread_cond_wait(&par->wake, &par->lock);
+        }
+        if (par->quit) {
+            break;
+        }
+        seen = par->generation;
+        pthread_mutex_unlock(&par->lock);
+
+        par_work(par, worker);
+
+        pthread_mutex_lock(&par->lock);
+        if (--par->running == 0) {
+            pthread_cond_signal(&par->done);
+        }
+    }
+    pthread_mutex_unlock(&par->lock);
+
+    return NULL;
+}
+
+static forth_par_t *par_create(const forth_t *parent) {
+    forth_par_t *par = calloc(1, sizeof(forth_par_t));
+
+    long cpus = FORTH_PAR_THREADS > 0 ? FORTH_PAR_THREADS
+                                      : sysconf(_SC_NPROCESSORS_ONLN);
+    par->count = cpus > 1 ? (size_t) cpus : 1;
+
+    // a worker gets its own stacks and loops, the heap and dictionary are
+    // shared and only read
+    par->workers =
+        aligned_alloc(_Alignof(forth_t), sizeof(forth_t) * par->count);
+    memset(par->workers, 0, sizeof(forth_t) * par->count);
+    for (size_t n = 0; n < par->count; n++) {
+        forth_t *worker = &par->workers[n];
+        worker->data_stack = stack_init(parent->data_stack.size);
+        worker->control_stack = stack_init(parent->control_stack.size);
+        worker->loop_size = parent->loop_size;
+        worker->loops = calloc(worker->loop_size, sizeof(forth_loop_t));
+        worker->par = par;
+    }
+
+    pthread_mutex_init(&par->lock, NULL);
+    pthread_cond_init(&par->wake, NULL);
+    pthread_cond_init(&par->done, NULL);
+
+    par->threads = calloc(par->count, sizeof(pthread_t));
+    for (size_t n = 1; n < par->count; n++) {
+        pthread_create(&par->threads[n], NULL, par_thread, &par->workers[n]);
+    }
+
+    return par;
+}
+
+static void par_destroy(forth_par_t *par) {
+    if (par == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&par->lock);
+    par->quit = 1;
+    pthread_cond_broadcast(&par->wake);
+    pthread_mutex_unlock(&par->lock);
+
+    for (size_t n = 1; n < par->count; n++) {
+        pthread_join(par->threads[n], NULL);
+    }
+
+    for (size_t n = 0; n < par->count; n++) {
+        forth_t *worker = &par->workers[n];
+        stack_destroy(&worker->data_stack);
+        stack_destroy(&worker->control_stack);
+        free(worker->return_stack.frames);
+        free(worker->loops);
+    }
+
+    pthread_mutex_destroy(&par->lock);
+    pthread_cond_destroy(&par->wake);
+    pthread_cond_destroy(&par->done);
+    free(par->threads);
+    free(par->workers);
+    free(par);
+}
+
+static void par_split(forth_par_t *par, int64_t start, int64_t limit) {
+    uint64_t total = (uint64_t) (limit - start);
+    uint64_t count = par->count * PAR_CHUNKS_PER_THREAD;
+    if (count > total) {
+        count = total;
+    }
+
+    uint64_t size = total / count;
+    uint64_t rest = total % count;
+
+    par->chunks = calloc(count, sizeof(forth_par_chunk_t));
+    par->chunk_count = count;
+    for (uint64_t n = 0; n < count; n++) {
+        forth_par_chunk_t *chunk = &par->chunks[n];
+        chunk->start = start;
+        chunk->end = start + (int64_t) (size + (n < rest));
+        chunk->fold.empty = 1;
+        start = chunk->end;
+    }
+}
+
+// limit start par-do ... par-loop, ip is the par-do
+static void par_do(forth_t *forth, const struct forth_instr_s *ip) {
+    int64_t start = stack_pop(&forth->data_stack).int64;
+    int64_t limit = stack_pop(&forth->data_stack).int64;
+    enum FORTH_OPCODE op = ip[ip->offset - 1].op;
+    forth_par_fold_t fold = {.empty = 1};
+
+    if (start < limit && forth->par == NULL && par_capture == NULL) {
+        forth->par = par_create(forth);
+    }
+
+    // nested par-do loops run on the thread that reached them
+    if (start < limit && (par_capture != NULL || forth->par->count == 1)) {
+        par_run_chunk(forth, ip + 1, start, limit, &fold);
+    } else if (start < limit) {
+        forth_par_t *par = forth->par;
+        par_split(par, start, limit);
+        // each chunk's numbers are a part of the parent's stream no other
+        // chunk or later par-do gets, so they don't depend on which worker
+        // takes the chunk
+        for (size_t n = 0; n < par->chunk_count; n++) {
+            random_jump(forth->random);
+            memcpy(par->chunks[n].random, forth->random,
+                   sizeof(par->chunks[n].random));
+        }
+
+        // workers only read the parent's stacks, it waits for them below
+        pthread_mutex_lock(&par->lock);
+        for (size_t n = 0; n < par->count; n++) {
+            forth_t *worker = &par->workers[n];
+            worker->heap = forth->heap;
+            worker->heap_size = forth->heap_size;
+            worker->next_address = forth->next_address;
+            // segments are read through the parent's tables, which can't
+            // grow while a par-do runs
+            worker->regions = forth->regions;
+            worker->region_count = forth->region_count;
+            worker->xts = forth->xts;
+            worker->xt_count = forth->xt_count;
+            worker->root = forth->root;
+            worker->state = forth->state;
+            worker->base = forth->base;
+            worker->hold_start = FORTH_HOLD_SIZE;
+            // bodies are compiled, so workers only read the strings
+            worker->transient = forth->transient;
+            worker->params = forth->params;
+        }
+        par->parent = forth;
+        par->body = ip + 1;
+        atomic_store(&par->next, 0);
+        atomic_store(&par->failed, 0);
+        atomic_store(&par->fuel, forth->fuel);
+        par->running = par->count - 1;
+        par->generation++;
+        pthread_cond_broadcast(&par->wake);
+        pthread_mutex_unlock(&par->lock);
+
+        par_work(par, &par->workers[0]);
+
+        pthread_mutex_lock(&par->lock);
+        while (par->running > 0) {
+            pthread_cond_wait(&par->done, &par->lock);
+        }
+        pthread_mutex_unlock(&par->lock);
+
+        // calls the workers made are counted as the parent's
+        for (size_t n = 0; n < par->count; n++) {
+            forth_stats_t *stats = &par->workers[n].stats;
+            forth->stats.user_calls += stats->user_calls;
+            forth->stats.builtin_calls += stats->builtin_calls;
+            forth->stats.ffi_calls += stats->ffi_calls;
+            *stats = (forth_stats_t) {0};
+        }
+
+        for (size_t n = 0; n < par->chunk_count; n++) {
+            forth_par_chunk_t *chunk = &par->chunks[n];
+            if (chunk->length > 0) {
+                FORTH_OUTPUT_FUNCTION("%.*s", (int) chunk->length,
+                                      chunk->output);
+            }
+            if (!chunk->fold.empty) {
+                par_fold(&fold, op, chunk->fold.value);
+            }
+            free(chunk->output);
+        }
+        free(par->chunks);
+        par->chunks = NULL;
+
+        // chunks running at once can overdraw the fuel between them, which
+        // is only seen once they are all done
+        forth->fuel = atomic_load(&par->fuel);
+        int failed = atomic_load(&par->failed);
+        if (failed) {
+            forth_throw(forth, failed, "%s", par->message);
+        } else if (forth->fuel < 0) {
+            forth_throw(forth, FORTH_THROW_OUT_OF_FUEL, "out of fuel");
+        }
+    }
+
+    if (op != OP_PAR_LOOP) {
+        stack_push(&forth->data_stack,
+                   fold.empty ? forth_i64(0) : fold.value);
+    }
+}
@@ -0,0 +1,366 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "forth.h"
+
+// one node of the calling context tree, i.e. one distinct call stack
+typedef struct forth_profile_node_s {
+    trie_node_t *word;
+    struct forth_profile_node_s *parent;
+    struct forth_profile_node_s *children;
+    struct forth_profile_node_s *next;
+
+    uint64_t calls;
+    uint64_t total_ns;
+    uint64_t self_ns;
+} forth_profile_node_t;
+
+// a word that is currently executing
+typedef struct {
+    forth_profile_node_t *node;
+    uint64_t start_ns;
+    uint64_t child_ns;
+} forth_profile_activation_t;
+
+typedef struct forth_profile_s {
+    forth_profile_node_t root;
+    forth_profile_node_t *current;
+
+    forth_profile_activation_t *activations;
+    size_t depth;
+    size_t capacity;
+} forth_profile_t;
+
+// per word totals, only built when a report is requested
+typedef struct {
+    trie_node_t *word;
+    uint64_t calls;
+    uint64_t incl_ns;
+    uint64_t excl_ns;
+    int64_t active;
+} forth_profile_word_t;
+
+// caller -> callee totals
+typedef struct {
+    trie_node_t *caller;
+    trie_node_t *callee;
+    uint64_t calls;
+    uint64_t incl_ns;
+} forth_profile_edge_t;
+
+static inline uint64_t profile_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static forth_profile_t *profile_create(void) {
+    forth_profile_t *profile = calloc(1, sizeof(forth_profile_t));
+    profile->current = &profile->root;
+    return profile;
+}
+
+static void profile_clear_tree(forth_profile_t *profile) {
+    // free every node below the root without recursing, the tree is as deep
+    // as the deepest call chain seen
+    forth_profile_node_t *node = profile->root.children;
+    while (node != NULL) {
+        if (node->children != NULL) {
+            node = node->children;
+            continue;
+        }
+
+        forth_profile_node_t *parent = node->parent;
+        parent->children = node->next;
+        free(node);
+        node = (parent == &profile->root) ? parent->children : parent;
+    }
+
+    memset(&profile->root, 0, sizeof(profile->root));
+    profile->current = &profile->root;
+    profile->depth = 0;
+}
+
+static void profile_destroy(forth_profile_t *profile) {
+    if (profile == NULL) {
+        return;
+    }
+
+    profile_clear_tree(profile);
+    free(profile->activations);
+    free(profile);
+}
+
+static void profile_enter(forth_profile_t *profile, trie_node_t *word) {
+    forth_profile_node_t *parent = profile->current;
+    forth_profile_node_t *child = parent->children;
+
+    while (child != NULL && child->word != word) {
+        child = child->next;
+    }
+
+    if (child == NULL) {
+        child = calloc(1, sizeof(forth_profile_node_t));
+        child->word = word;
+        child->parent = parent;
+        child->next = parent->children;
+        parent->children = child;
+    }
+
+    if (profile->depth == profile->capacity) {
+        profile->capacity = profile->capacity ? profile->capacity * 2 : 64;
+        profile->activations =
+            realloc(profile->activations, sizeof(forth_profile_activation_t) *
+                                              profile->capacity);
+    }
+
+    child->calls++;
+    profile->activations[profile->depth++] =
+        (forth_profile_activation_t) {child, profile_now_ns(), 0};
+    profile->current = child;
+}
+
+static void profile_exit(forth_profile_t *profile) {
+    // words entered before profiling started have no activation
+    if (profile->depth == 0) {
+        return;
+    }
+
+    forth_profile_activation_t act = profile->activations[--profile->depth];
+    uint64_t elapsed = profile_now_ns() - act.start_ns;
+
+    act.node->total_ns += elapsed;
+    act.node->self_ns += elapsed - act.child_ns;
+
+    if (profile->depth > 0) {
+        profile->activations[profile->depth - 1].child_ns += elapsed;
+    }
+
+    profile->current = act.node->parent;
+}
+
+// pointer keyed open addressing tables used while building reports
+
+static size_t profile_hash(const void *a, const void *b, size_t mask) {
+    uint64_t h = (uint64_t) (uintptr_t) a * 0x9e3779b97f4a7c15ull;
+    h ^= (uint64_t) (uintptr_t) b * 0xc2b2ae3d27d4eb4full;
+    return (size_t) (h >> 17) & mask;
+}
+
+static size_t profile_count_nodes(forth_profile_t *profile) {
+    size_t count = 0;
+    forth_profile_node_t *node = profile->root.children;
+
+    while (node != NULL) {
+        count++;
+        if (node->children != NULL) {
+            node = node->children;
+            continue;
+        }
+        while (node != NULL && node->next == NULL) {
+            node = node->parent;
+            if (node == &profile->root) {
+                node = NULL;
+            }
+        }
+        if (node != NULL) {
+            node = node->next;
+        }
+    }
+
+    return count;
+}
+
+static size_t profile_table_size(size_t entries) {
+    size_t size = 64;
+    while (size < entries * 2) {
+        size *= 2;
+    }
+    return size;
+}
+
+static forth_profile_word_t *profile_word_slot(forth_profile_word_t *table,
+                                               size_t mask,
+                                               trie_node_t *word) {
+    size_t idx = profile_hash(word, NULL, mask);
+    while (table[idx].word != NULL && table[idx].word != word) {
+        idx = (idx + 1) & mask;
+    }
+    table[idx].word = word;
+    return &table[idx];
+}
+
+static forth_profile_edge_t *profile_edge_slot(forth_profile_edge_t *table,
+                                               size_t mask,
+                                               trie_node_t *caller,
+                                               trie_node_t *callee) {
+    size_t idx = profile_hash(caller, callee, mask);
+    while (table[idx].callee != NULL &&
+           (table[idx].caller != caller || table[idx].callee != callee)) {
+        idx = (idx + 1) & mask;
+    }
+    table[idx].caller = caller;
+    table[idx].callee = callee;
+    return &table[idx];
+}
+
+// aggregate the calling context tree into per word and per edge totals.
+// inclusive time is only counted for the outermost activation of a word so
+// recursion isn't double counted
+static void profile_aggregate(forth_profile_t *profile,
+                              forth_profile_word_t *words, size_t words_mask,
+                              forth_profile_edge_t *edges, size_t edges_mask) {
+    forth_profile_node_t *node = profile->root.children;
+
+    while (node != NULL) {
+        forth_profile_word_t *w =
+            profile_word_slot(words, words_mask, node->word);
+        w->calls += node->calls;
+        w->excl_ns += node->self_ns;
+        if (w->active == 0) {
+            w->incl_ns += node->total_ns;
+        }
+
+        if (node->parent != &profile->root) {
+            forth_profile_edge_t *e = profile_edge_slot(
+                edges, edges_mask, node->parent->word, node->word);
+            e->calls += node->calls;
+            e->incl_ns += node->total_ns;
+        }
+
+        // descend, marking this word as active on the current path
+        if (node->children != NULL) {
+            w->active++;
+            node = node->children;
+            continue;
+        }
+
+        while (node != NULL && node->next == NULL) {
+            node = node->parent;
+            if (node == &profile->root) {
+                node = NULL;
+            } else {
+                profile_word_slot(words, words_mask, node->word)->active--;
+            }
+        }
+        if (node != NULL) {
+            node = node->next;
+        }
+    }
+}
+
+static int profile_compare_words(const void *a, const void *b) {
+    const forth_profile_word_t *wa = a;
+    const forth_profile_word_t *wb = b;
+    if (wa->excl_ns != wb->excl_ns) {
+        return wa->excl_ns < wb->excl_ns ? 1 : -1;
+    }
+    return wa->calls < wb->calls ? 1 : (wa->calls > wb->calls ? -1 : 0);
+}
+
+static int profile_compare_edges(const void *a, const void *b) {
+    const forth_profile_edge_t *ea = a;
+    const forth_profile_edge_t *eb = b;
+    if (ea->incl_ns != eb->incl_ns) {
+        return ea->incl_ns < eb->incl_ns ? 1 : -1;
+    }
+    return ea->calls < eb->calls ? 1 : (ea->calls > eb->calls ? -1 : 0);
+}
+
+static void profile_print_report(forth_profile_t *profile) {
+    size_t nodes = profile_count_nodes(profile);
+    size_t size = profile_table_size(nodes);
+
+    forth_profile_word_t *words = calloc(size, sizeof(forth_profile_word_t));
+    forth_profile_edge_t *edges = calloc(size, sizeof(forth_profile_edge_t));
+    profile_aggregate(profile, words, size - 1, edges, size - 1);
+
+    // compact the tables so they can be sorted
+    size_t word_count = 0;
+    size_t edge_count = 0;
+    uint64_t total_ns = 0;
+    for (size_t idx = 0; idx < size; idx++) {
+        if (words[idx].word != NULL) {
+            total_ns += words[idx].excl_ns;
+            words[word_count++] = words[idx];
+        }
+        if (edges[idx].callee != NULL) {
+            edges[edge_count++] = edges[idx];
+        }
+    }
+    qsort(words, word_count, sizeof(*words), profile_compare_words);
+    qsort(edges, edge_count, sizeof(*edges), profile_compare_edges);
+
+    FORTH_OUTPUT_FUNCTION("%-24s %12s %16s %16s %7s\n", "word", "calls",
+                          "incl ns", "excl ns", "excl %");
+    for (size_t idx = 0; idx < word_count; idx++) {
+        forth_profile_word_t *w = &words[idx];
+        double pct = total_ns ? 100.0 * (double) w->excl_ns / total_ns : 0.0;
+        FORTH_OUTPUT_FUNCTION("%-24s %12llu %16llu %16llu %6.2f%%\n",
+                              w->word->name, (unsigned long long) w->calls,
+                              (unsigned long long) w->incl_ns,
+                              (unsigned long long) w->excl_ns, pct);
+    }
+
+    FORTH_OUTPUT_FUNCTION("\n%-24s %-24s %12s %16s\n", "caller", "callee",
+                          "calls", "incl ns");
+    for (size_t idx = 0; idx < edge_count; idx++) {
+        forth_profile_edge_t *e = &edges[idx];
+        FORTH_OUTPUT_FUNCTION("%-24s %-24s %12llu %16llu\n", e->caller->name,
+                              e->callee->name, (unsigned long long) e->calls,
+                              (unsigned long long) e->incl_ns);
+    }
+
+    free(words);
+    free(edges);
+}
+
+// one line per distinct call stack: "outer;inner;leaf self_ns", the format
+// consumed by flamegraph.pl and friends
+static void profile_write_folded(forth_profile_t *profile, FILE *fp) {
+    size_t path_capacity = 64;
+    forth_profile_node_t **path =
+        malloc(sizeof(forth_profile_node_t *) * path_capacity);
+
+    forth_profile_node_t *node = profile->root.children;
+    while (node != NULL) {
+        if (node->self_ns > 0) {
+            size_t depth = 0;
+            for (forth_profile_node_t *n = node; n != &profile->root;
+                 n = n->parent) {
+                if (depth == path_capacity) {
+                    path_capacity *= 2;
+                    path = realloc(path, sizeof(*path) * path_capacity);
+                }
+                path[depth++] = n;
+            }
+
+            while (depth > 0) {
+                fputs(path[--depth]->word->name, fp);
+                fputc(depth > 0 ? ';' : ' ', fp);
+            }
+            fprintf(fp, "%llu\n", (unsigned long long) node->self_ns);
+        }
+
+        if (node->children != NULL) {
+            node = node->children;
+            continue;
+        }
+        while (node != NULL && node->next == NULL) {
+            node = node->parent;
+            if (node == &profile->root) {
+                node = NULL;
+            }
+        }
+        if (node != NULL) {
+            node = node->next;
+        }
+    }
+
+    free(path);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdint.h>
+
+// xoshiro256** (Blackman and Vigna 2018), four words of state per instance
+// so every interpreter and par-do chunk has a stream of its own
+
+__extension__ typedef unsigned __int128 random_u128;
+
+static inline uint64_t random_rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t random_next(uint64_t *s) {
+    uint64_t result = random_rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = random_rotl(s[3], 45);
+
+    return result;
+}
+
+// spreads a single number over the state with splitmix64, which never
+// leaves it all zero
+static void random_seed(uint64_t *s, uint64_t seed) {
+    for (int n = 0; n < 4; n++) {
+        uint64_t z = (seed += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        s[n] = z ^ (z >> 31);
+    }
+}
+
+// moves the state 2^128 numbers ahead, so streams split off by jumping
+// never overlap
+static void random_jump(uint64_t *s) {
+    static const uint64_t jump[] = {0x180ec6d33cfd0aba, 0xd5a61266f0c9392c,
+                                    0xa9582618e03fc9aa, 0x39abdc4529b1661c};
+    uint64_t t[4] = {0};
+    for (int n = 0; n < 4; n++) {
+        for (int b = 0; b < 64; b++) {
+            if (jump[n] & ((uint64_t) 1 << b)) {
+                t[0] ^= s[0];
+                t[1] ^= s[1];
+                t[2] ^= s[2];
+                t[3] ^= s[3];
+            }
+            random_next(s);
+        }
+    }
+    s[0] = t[0];
+    s[1] = t[1];
+    s[2] = t[2];
+    s[3] = t[3];
+}
+
+// uniform in [0, 1) from the top 53 bits
+static inline double random_double(uint64_t *s) {
+    return (double) (random_next(s) >> 11) * 0x1.0p-53;
+}
+
+// uniform in [0, bound) without modulo bias (Lemire 2019), a bound of 0
+// gives the whole 64 bits
+static inline uint64_t random_below(uint64_t *s, uint64_t bound) {
+    uint64_t x = random_next(s);
+    if (bound == 0) {
+        return x;
+    }
+    random_u128 m = (random_u128) x * bound;
+    if ((uint64_t) m < bound) {
+        uint64_t threshold = (0 - bound) % bound;
+        while ((uint64_t) m < threshold) {
+            m = (random_u128) random_next(s) * bound;
+        }
+    }
+    return (uint64_t) (m >> 64);
+}
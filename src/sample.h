@@ -0,0 +1,480 @@
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "forth.h"
+#include "profile.h"
+
+#ifndef FORTH_SAMPLE_DEPTH
+// innermost frames recorded per sample
+#define FORTH_SAMPLE_DEPTH 16
+#endif
+
+#ifndef FORTH_SAMPLE_CAPACITY
+// samples kept before further ones are dropped
+#define FORTH_SAMPLE_CAPACITY 65536
+#endif
+
+// shadow stack frames kept for the signal handler, deeper calls are counted
+// but not recorded
+#define SAMPLE_STACK_SIZE 4096
+
+enum SAMPLE_COUNTER {
+    SAMPLE_CYCLES,
+    SAMPLE_INSTRUCTIONS,
+    SAMPLE_CACHE_MISSES,
+    SAMPLE_BRANCH_MISSES,
+    SAMPLE_COUNTER_COUNT,
+};
+
+typedef struct {
+    uint64_t counters[SAMPLE_COUNTER_COUNT];
+    uint32_t depth;
+    uint32_t truncated;
+    trie_node_t *frames[FORTH_SAMPLE_DEPTH]; // innermost first
+} forth_sample_t;
+
+typedef struct forth_sampler_s {
+    // words currently executing, maintained by forth_eval
+    trie_node_t *stack[SAMPLE_STACK_SIZE];
+    volatile size_t depth;
+
+    forth_sample_t *samples;
+    volatile size_t count;
+    volatile uint64_t dropped;
+
+    // sampling trigger, a task-clock perf event or ITIMER_PROF
+    int clock_fd;
+    unsigned interval_us;
+    const char *trigger;
+
+    // hardware counters, read as one group on every sample
+    int counter_fds[SAMPLE_COUNTER_COUNT];
+    int counter_slot[SAMPLE_COUNTER_COUNT];
+    int counter_count;
+    uint64_t last[SAMPLE_COUNTER_COUNT];
+
+    struct sigaction old_action;
+} forth_sampler_t;
+
+// SIGPROF is process wide so only one sampler can be running at a time
+static forth_sampler_t *volatile sample_active = NULL;
+
+static const char *sample_counter_names[SAMPLE_COUNTER_COUNT] = {
+    "cycles",
+    "instructions",
+    "cache-misses",
+    "branch-misses",
+};
+
+static inline void sample_push(forth_sampler_t *sampler, trie_node_t *word) {
+    size_t depth = sampler->depth;
+    if (depth < SAMPLE_STACK_SIZE) {
+        sampler->stack[depth] = word;
+    }
+    // publish the frame before the depth that makes it visible
+    atomic_signal_fence(memory_order_seq_cst);
+    sampler->depth = depth + 1;
+}
+
+static inline void sample_pop(forth_sampler_t *sampler) {
+    if (sampler->depth > 0) {
+        sampler->depth = sampler->depth - 1;
+    }
+}
+
+static long sample_perf_open(struct perf_event_attr *attr, int group_fd) {
+    return syscall(SYS_perf_event_open, attr, 0, -1, group_fd, 0);
+}
+
+static void sample_open_counters(forth_sampler_t *sampler) {
+    static const uint64_t configs[SAMPLE_COUNTER_COUNT] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES,
+    };
+
+    int leader = -1;
+    sampler->counter_count = 0;
+
+    for (int idx = 0; idx < SAMPLE_COUNTER_COUNT; idx++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[idx];
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.disabled = (leader == -1);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        int fd = (int) sample_perf_open(&attr, leader);
+        sampler->counter_fds[idx] = fd;
+        sampler->counter_slot[idx] = -1;
+        if (fd < 0) {
+            continue;
+        }
+
+        if (leader == -1) {
+            leader = fd;
+        }
+        sampler->counter_slot[idx] = sampler->counter_count++;
+    }
+
+    if (leader != -1) {
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+static int sample_counter_leader(forth_sampler_t *sampler) {
+    for (int idx = 0; idx < SAMPLE_COUNTER_COUNT; idx++) {
+        if (sampler->counter_slot[idx] == 0) {
+            return sampler->counter_fds[idx];
+        }
+    }
+    return -1;
+}
+
+static void sample_read_counters(forth_sampler_t *sampler,
+                                 uint64_t out[SAMPLE_COUNTER_COUNT]) {
+    uint64_t buf[1 + SAMPLE_COUNTER_COUNT];
+    memset(out, 0, sizeof(uint64_t) * SAMPLE_COUNTER_COUNT);
+
+    int leader = sample_counter_leader(sampler);
+    if (leader < 0) {
+        return;
+    }
+    if (read(leader, buf, sizeof(buf)) < (ssize_t) sizeof(buf[0])) {
+        return;
+    }
+
+    for (int idx = 0; idx < SAMPLE_COUNTER_COUNT; idx++) {
+        int slot = sampler->counter_slot[idx];
+        if (slot >= 0 && (uint64_t) slot < buf[0]) {
+            out[idx] = buf[1 + slot];
+        }
+    }
+}
+
+static void sample_signal_handler(int sig, siginfo_t *info, void *ctx) {
+    (void) sig;
+    (void) info;
+    (void) ctx;
+
+    forth_sampler_t *sampler = sample_active;
+    if (sampler == NULL) {
+        return;
+    }
+
+    int saved_errno = errno;
+
+    uint64_t now[SAMPLE_COUNTER_COUNT];
+    sample_read_counters(sampler, now);
+
+    if (sampler->count < FORTH_SAMPLE_CAPACITY) {
+        forth_sample_t *sample = &sampler->samples[sampler->count];
+
+        for (int idx = 0; idx < SAMPLE_COUNTER_COUNT; idx++) {
+            sample->counters[idx] = now[idx] - sampler->last[idx];
+        }
+
+        size_t depth = sampler->depth;
+        size_t recorded = depth < SAMPLE_STACK_SIZE ? depth : SAMPLE_STACK_SIZE;
+        size_t n = 0;
+        while (n < FORTH_SAMPLE_DEPTH && n < recorded) {
+            sample->frames[n] = sampler->stack[recorded - 1 - n];
+            n++;
+        }
+        sample->depth = (uint32_t) n;
+        sample->truncated = depth > n;
+
+        sampler->count = sampler->count + 1;
+    } else {
+        sampler->dropped = sampler->dropped + 1;
+    }
+
+    memcpy(sampler->last, now, sizeof(now));
+
+    if (sampler->clock_fd >= 0) {
+        ioctl(sampler->clock_fd, PERF_EVENT_IOC_REFRESH, 1);
+    }
+
+    errno = saved_errno;
+}
+
+// returns 1 when driven by a perf task-clock event, 0 for the ITIMER_PROF
+// fallback and -1 on failure
+static int sample_start(forth_sampler_t *sampler, unsigned interval_us) {
+    if (sample_active != NULL) {
+        return -1;
+    }
+
+    if (sampler->samples == NULL) {
+        sampler->samples =
+            malloc(sizeof(forth_sample_t) * FORTH_SAMPLE_CAPACITY);
+    }
+    sampler->interval_us = interval_us;
+    sampler->clock_fd = -1;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = sample_signal_handler;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, &sampler->old_action) != 0) {
+        return -1;
+    }
+
+    sample_open_counters(sampler);
+    sample_read_counters(sampler, sampler->last);
+    sample_active = sampler;
+
+    // task-clock counts cpu nanoseconds of this thread only and its
+    // overflow signal is delivered to this thread
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.config = PERF_COUNT_SW_TASK_CLOCK;
+    attr.sample_period = (uint64_t) interval_us * 1000;
+    attr.wakeup_events = 1;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    int fd = (int) sample_perf_open(&attr, -1);
+    if (fd >= 0) {
+        struct f_owner_ex owner = {F_OWNER_TID, (pid_t) syscall(SYS_gettid)};
+        if (fcntl(fd, F_SETFL, O_ASYNC) == 0 &&
+            fcntl(fd, F_SETSIG, SIGPROF) == 0 &&
+            fcntl(fd, F_SETOWN_EX, &owner) == 0) {
+            sampler->clock_fd = fd;
+            sampler->trigger = "perf task-clock";
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_REFRESH, 1);
+            return 1;
+        }
+        close(fd);
+    }
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = interval_us / 1000000;
+    timer.it_interval.tv_usec = interval_us % 1000000;
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+        sample_active = NULL;
+        sigaction(SIGPROF, &sampler->old_action, NULL);
+        return -1;
+    }
+    sampler->trigger = "ITIMER_PROF";
+    return 0;
+}
+
+static void sample_stop(forth_sampler_t *sampler) {
+    if (sample_active != sampler) {
+        return;
+    }
+
+    if (sampler->clock_fd >= 0) {
+        ioctl(sampler->clock_fd, PERF_EVENT_IOC_DISABLE, 0);
+        close(sampler->clock_fd);
+        sampler->clock_fd = -1;
+    } else {
+        struct itimerval timer;
+        memset(&timer, 0, sizeof(timer));
+        setitimer(ITIMER_PROF, &timer, NULL);
+    }
+
+    sample_active = NULL;
+    sigaction(SIGPROF, &sampler->old_action, NULL);
+
+    // the slots are kept so a report can tell which counters were recorded
+    for (int idx = 0; idx < SAMPLE_COUNTER_COUNT; idx++) {
+        if (sampler->counter_fds[idx] >= 0) {
+            close(sampler->counter_fds[idx]);
+        }
+        sampler->counter_fds[idx] = -1;
+    }
+}
+
+static forth_sampler_t *sample_create(void) {
+    forth_sampler_t *sampler = calloc(1, sizeof(forth_sampler_t));
+    sampler->clock_fd = -1;
+    for (int idx = 0; idx < SAMPLE_COUNTER_COUNT; idx++) {
+        sampler->counter_fds[idx] = -1;
+        sampler->counter_slot[idx] = -1;
+    }
+    return sampler;
+}
+
+static void sample_destroy(forth_sampler_t *sampler) {
+    if (sampler == NULL) {
+        return;
+    }
+
+    sample_stop(sampler);
+    free(sampler->samples);
+    free(sampler);
+}
+
+// per word sample totals, built when a report is requested
+typedef struct {
+    trie_node_t *word;
+    uint64_t self;
+    uint64_t total;
+    uint64_t counters[SAMPLE_COUNTER_COUNT];
+    size_t last_sample;
+} forth_sample_word_t;
+
+static forth_sample_word_t *sample_word_slot(forth_sample_word_t *table,
+                                             size_t mask, trie_node_t *word) {
+    size_t idx = profile_hash(word, NULL, mask);
+    while (table[idx].word != NULL && table[idx].word != word) {
+        idx = (idx + 1) & mask;
+    }
+    if (table[idx].word == NULL) {
+        table[idx].word = word;
+        table[idx].last_sample = SIZE_MAX;
+    }
+    return &table[idx];
+}
+
+static int sample_compare_words(const void *a, const void *b) {
+    const forth_sample_word_t *wa = a;
+    const forth_sample_word_t *wb = b;
+    if (wa->self != wb->self) {
+        return wa->self < wb->self ? 1 : -1;
+    }
+    return wa->total < wb->total ? 1 : (wa->total > wb->total ? -1 : 0);
+}
+
+static double sample_ratio(uint64_t num, uint64_t den, double scale) {
+    return den ? scale * (double) num / (double) den : 0.0;
+}
+
+static void sample_print_report(forth_sampler_t *sampler) {
+    size_t count = sampler->count;
+    size_t size = profile_table_size(count * FORTH_SAMPLE_DEPTH + 1);
+    forth_sample_word_t *words = calloc(size, sizeof(forth_sample_word_t));
+
+    // samples taken outside of any word are charged to the outer interpreter
+    trie_node_t outer;
+    memset(&outer, 0, sizeof(outer));
+    outer.name = (char *) "[interpreter]";
+
+    for (size_t n = 0; n < count; n++) {
+        forth_sample_t *sample = &sampler->samples[n];
+        trie_node_t *leaf = sample->depth ? sample->frames[0] : &outer;
+
+        forth_sample_word_t *w = sample_word_slot(words, size - 1, leaf);
+        w->self++;
+        for (int idx = 0; idx < SAMPLE_COUNTER_COUNT; idx++) {
+            w->counters[idx] += sample->counters[idx];
+        }
+
+        if (sample->depth == 0) {
+            w->total++;
+            continue;
+        }
+
+        // each word counts once per sample however deep it recursed
+        for (uint32_t f = 0; f < sample->depth; f++) {
+            forth_sample_word_t *t =
+                sample_word_slot(words, size - 1, sample->frames[f]);
+            if (t->last_sample != n) {
+                t->last_sample = n;
+                t->total++;
+            }
+        }
+    }
+
+    size_t word_count = 0;
+    for (size_t idx = 0; idx < size; idx++) {
+        if (words[idx].word != NULL) {
+            words[word_count++] = words[idx];
+        }
+    }
+    qsort(words, word_count, sizeof(*words), sample_compare_words);
+
+    FORTH_OUTPUT_FUNCTION("%zu samples, %llu dropped, one per %u us of cpu "
+                          "time from %s\n",
+                          count, (unsigned long long) sampler->dropped,
+                          sampler->interval_us, sampler->trigger);
+
+    if (sampler->counter_count == 0) {
+        FORTH_OUTPUT_FUNCTION("%-24s %8s %7s %7s\n", "word", "samples",
+                              "self %", "total %");
+    } else {
+        FORTH_OUTPUT_FUNCTION("%-24s %8s %7s %7s %14s %14s %6s %8s %8s\n",
+                              "word", "samples", "self %", "total %", "cycles",
+                              "instructions", "ipc", "cache", "branch");
+        FORTH_OUTPUT_FUNCTION("%-24s %8s %7s %7s %14s %14s %6s %8s %8s\n", "",
+                              "", "", "", "", "", "", "mpki", "mpki");
+    }
+
+    for (size_t idx = 0; idx < word_count; idx++) {
+        forth_sample_word_t *w = &words[idx];
+        uint64_t *c = w->counters;
+
+        FORTH_OUTPUT_FUNCTION("%-24s %8llu %6.2f%% %6.2f%%", w->word->name,
+                              (unsigned long long) w->self,
+                              sample_ratio(w->self, count, 100.0),
+                              sample_ratio(w->total, count, 100.0));
+        if (sampler->counter_count != 0) {
+            FORTH_OUTPUT_FUNCTION(
+                " %14llu %14llu %6.2f %8.2f %8.2f",
+                (unsigned long long) c[SAMPLE_CYCLES],
+                (unsigned long long) c[SAMPLE_INSTRUCTIONS],
+                sample_ratio(c[SAMPLE_INSTRUCTIONS], c[SAMPLE_CYCLES], 1.0),
+                sample_ratio(c[SAMPLE_CACHE_MISSES], c[SAMPLE_INSTRUCTIONS],
+                             1000.0),
+                sample_ratio(c[SAMPLE_BRANCH_MISSES], c[SAMPLE_INSTRUCTIONS],
+                             1000.0));
+        }
+        FORTH_OUTPUT_FUNCTION("\n");
+    }
+
+    for (int idx = 0; idx < SAMPLE_COUNTER_COUNT; idx++) {
+        if (sampler->counter_slot[idx] < 0) {
+            FORTH_OUTPUT_FUNCTION("note: %s counter not available\n",
+                                  sample_counter_names[idx]);
+        }
+    }
+
+    free(words);
+}
+
+// folded stacks weighted by sample count
+static void sample_write_folded(forth_sampler_t *sampler, FILE *fp) {
+    for (size_t n = 0; n < sampler->count; n++) {
+        forth_sample_t *sample = &sampler->samples[n];
+
+        if (sample->depth == 0) {
+            fputs("[interpreter] 1\n", fp);
+            continue;
+        }
+
+        if (sample->truncated) {
+            fputs("[truncated];", fp);
+        }
+        for (uint32_t f = sample->depth; f > 0; f--) {
+            fputs(sample->frames[f - 1]->name, fp);
+            fputc(f > 1 ? ';' : ' ', fp);
+        }
+        fputs("1\n", fp);
+    }
+}
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "forth.h"
+
+// meili --serve: a pool of processes forked from an instance that already
+// loaded the files on the command line. a worker serves one connection and
+// exits, then the parent forks a fresh one from the warm instance, so no
+// connection sees words another one defined
+//
+// a request is a 4 byte big endian length and that much forth text. the
+// response is the throw code, the length of what the text printed and the
+// length of the error message (4 bytes each, big endian), then those two.
+// requests can be pipelined, responses come back in the same order
+
+#ifndef SERVE_MAX_REQUEST
+// longest request text, a connection that sends more is closed
+#define SERVE_MAX_REQUEST (16 << 20)
+#endif
+
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} serve_buffer_t;
+
+static volatile sig_atomic_t serve_stop;
+
+static void serve_signal(int sig) {
+    (void) sig;
+    serve_stop = 1;
+}
+
+static void serve_reserve(serve_buffer_t *buf, size_t extra) {
+    if (buf->length + extra <= buf->capacity) {
+        return;
+    }
+    while (buf->length + extra > buf->capacity) {
+        buf->capacity = buf->capacity ? buf->capacity * 2 : 65536;
+    }
+    buf->data = realloc(buf->data, buf->capacity);
+}
+
+static void serve_append(serve_buffer_t *buf, const void *data, size_t len) {
+    serve_reserve(buf, len);
+    memcpy(buf->data + buf->length, data, len);
+    buf->length += len;
+}
+
+static void serve_put_u32(serve_buffer_t *buf, uint32_t n) {
+    unsigned char bytes[4] = {n >> 24, n >> 16, n >> 8, n};
+    serve_append(buf, bytes, sizeof(bytes));
+}
+
+static uint32_t serve_get_u32(const char *data) {
+    const unsigned char *bytes = (const unsigned char *) data;
+    return (uint32_t) bytes[0] << 24 | (uint32_t) bytes[1] << 16 |
+           (uint32_t) bytes[2] << 8 | bytes[3];
+}
+
+static int serve_write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t done = write(fd, data, length);
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (done <= 0) {
+            return 0;
+        }
+        data += done;
+        length -= (size_t) done;
+    }
+    return 1;
+}
+
+// runs one request with everything it prints captured into the response
+static void serve_request(forth_t *forth, const char *text, size_t length,
+                          serve_buffer_t *out) {
+    char *source = malloc(length + 1);
+    memcpy(source, text, length);
+    source[length] = '\0';
+
+    // output goes through printf, so stdout itself is swapped out
+    char *printed = NULL;
+    size_t printed_length = 0;
+    FILE *capture = open_memstream(&printed, &printed_length);
+    FILE *saved = stdout;
+    stdout = capture;
+
+    int code = forth_eval(forth, source);
+    if (code == 0) {
+        forth_run_tasks(forth);
+    }
+
+    stdout = saved;
+    fclose(capture);
+
+    const char *message = code ? forth_error_message(forth) : "";
+    size_t message_length = strlen(message);
+    serve_put_u32(out, (uint32_t) code);
+    serve_put_u32(out, (uint32_t) printed_length);
+    serve_put_u32(out, (uint32_t) message_length);
+    serve_append(out, printed, printed_length);
+    serve_append(out, message, message_length);
+
+    free(printed);
+    free(source);
+}
+
+// answers every complete request read so far before writing, so pipelined
+// requests share reads and writes
+static void serve_connection(forth_t *forth, int fd) {
+    serve_buffer_t in = {0};
+    serve_buffer_t out = {0};
+
+    for (;;) {
+        size_t used = 0;
+        size_t want = 4;
+        while (in.length - used >= 4) {
+            uint32_t length = serve_get_u32(in.data + used);
+            if (length > SERVE_MAX_REQUEST) {
+                goto done;
+            }
+            if (in.length - used - 4 < length) {
+                want = 4 + length;
+                break;
+            }
+            serve_request(forth, in.data + used + 4, length, &out);
+            used += 4 + length;
+        }
+
+        if (out.length > 0 && !serve_write_all(fd, out.data, out.length)) {
+            break;
+        }
+        out.length = 0;
+
+        // keep the part of a request that hasn't all arrived
+        if (used > 0) {
+            memmove(in.data, in.data + used, in.length - used);
+            in.length -= used;
+        }
+        serve_reserve(&in, want > in.length ? want - in.length : 4);
+
+        ssize_t got = read(fd, in.data + in.length, in.capacity - in.length);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            break;
+        }
+        in.length += (size_t) got;
+    }
+
+done:
+    free(in.data);
+    free(out.data);
+}
+
+static void serve_worker(forth_t *forth, int listen_fd) {
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+
+    // the par-do and file threads stayed in the parent, the worker starts
+    // its own the first time it needs them
+    forth->par = NULL;
+    forth->aio = NULL;
+
+    int fd;
+    do {
+        fd = accept(listen_fd, NULL, NULL);
+    } while (fd < 0 && errno == EINTR);
+
+    if (fd >= 0) {
+        serve_connection(forth, fd);
+        close(fd);
+    }
+    fflush(stdout);
+    _exit(0);
+}
+
+// listens on path until SIGINT or SIGTERM with workers processes waiting
+// for connections, returns the exit status for main
+static int forth_serve(forth_t *forth, const char *path, size_t workers) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: socket path '%s' is too long\n", path);
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(path);
+    if (listen_fd < 0 ||
+        bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        listen(listen_fd, SOMAXCONN) < 0) {
+        fprintf(stderr, "Error: can't listen on '%s': %s\n", path,
+                strerror(errno));
+        return 1;
+    }
+
+    struct sigaction action = {.sa_handler = serve_signal};
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    // a client that hangs up early only ends its own connection
+    signal(SIGPIPE, SIG_IGN);
+
+    pid_t *pids = calloc(workers, sizeof(pid_t));
+    fflush(stdout);
+
+    while (!serve_stop) {
+        for (size_t n = 0; n < workers && !serve_stop; n++) {
+            if (pids[n] > 0) {
+                continue;
+            }
+            pid_t pid = fork();
+            if (pid == 0) {
+                serve_worker(forth, listen_fd);
+            } else if (pid < 0) {
+                fprintf(stderr, "Error: fork: %s\n", strerror(errno));
+                sleep(1);
+                break;
+            }
+            pids[n] = pid;
+        }
+
+        pid_t done = wait(NULL);
+        for (size_t n = 0; n < workers && done > 0; n++) {
+            if (pids[n] == done) {
+                pids[n] = 0;
+            }
+        }
+    }
+
+    for (size_t n = 0; n < workers; n++) {
+        if (pids[n] > 0) {
+            kill(pids[n], SIGTERM);
+            waitpid(pids[n], NULL, 0);
+        }
+    }
+    free(pids);
+    close(listen_fd);
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdlib.h>
+
+#include "forth.h"
+
+enum FORTH_TASK_STATE {
+    TASK_FREE,
+    TASK_RUNNING,
+    TASK_READY,
+    TASK_DONE,
+};
+
+// the stacks of a task while it isn't running, the running task's stacks are
+// the ones in forth_t. slot 0 is whatever the interpreter itself is running.
+// switches only happen at the bottom of a task's return stack, so every task
+// finishes when its return stack is empty
+typedef struct forth_task_s {
+    enum FORTH_TASK_STATE state;
+    forth_stack_t data_stack;
+    forth_stack_t control_stack;
+    forth_rstack_t return_stack;
+    forth_loop_t *loops;
+    int64_t loop_size;
+    int64_t loop_top;
+
+    const struct forth_instr_s *ip; // where it continues
+    forth_type_t result;            // top of its stack once done
+    int64_t awaiting;               // request it's waiting on, 0 if none
+} forth_task_t;
+
+// what pause and task-join run when typed outside a definition
+static const struct forth_instr_s task_pause_code[] = {{.op = OP_PAUSE},
+                                                      {.op = OP_EXIT}};
+static const struct forth_instr_s task_join_code[] = {{.op = OP_JOIN},
+                                                     {.op = OP_EXIT}};
+
+static void task_save(forth_t *forth, forth_task_t *task) {
+    task->data_stack = forth->data_stack;
+    task->control_stack = forth->control_stack;
+    task->return_stack = forth->return_stack;
+    task->loops = forth->loops;
+    task->loop_size = forth->loop_size;
+    task->loop_top = forth->loop_top;
+}
+
+static void task_load(forth_t *forth, const forth_task_t *task) {
+    forth->data_stack = task->data_stack;
+    forth->control_stack = task->control_stack;
+    forth->return_stack = task->return_stack;
+    forth->loops = task->loops;
+    forth->loop_size = task->loop_size;
+    forth->loop_top = task->loop_top;
+}
+
+static void task_free_stacks(forth_task_t *task) {
+    stack_destroy(&task->data_stack);
+    stack_destroy(&task->control_stack);
+    free(task->return_stack.frames);
+    task->return_stack.frames = NULL;
+    free(task->loops);
+    task->loops = NULL;
+}
+
+static void task_destroy_all(forth_t *forth) {
+    if (forth->tasks == NULL) {
+        return;
+    }
+
+    // slot 0 holds nothing of its own while the interpreter runs
+    for (int64_t n = 1; n < forth->task_count; n++) {
+        forth_task_t *task = &forth->tasks[n];
+        if (task->state == TASK_READY) {
+            task_free_stacks(task);
+        }
+    }
+    free(forth->tasks);
+    forth->tasks = NULL;
+    forth->task_count = 0;
+    forth->task = 0;
+}
+
+// returns the task's id, 0 if it couldn't be started
+static int64_t task_spawn(forth_t *forth, trie_node_t *word) {
+    if (word->node_type != TRIE_USERWORD) {
+        forth_throw(forth, FORTH_THROW_INVALID_ARGUMENT,
+                    "'%s' can't run as a task", word->name);
+        return 0;
+    }
+
+    if (forth->tasks == NULL) {
+        forth->task_count = 8;
+        forth->tasks = calloc(forth->task_count, sizeof(forth_task_t));
+        forth->tasks[0].state = TASK_RUNNING;
+        forth->task = 0;
+    }
+
+    int64_t id = 1;
+    while (id < forth->task_count && forth->tasks[id].state != TASK_FREE) {
+        id++;
+    }
+    if (id == forth->task_count) {
+        forth->task_count *= 2;
+        forth->tasks =
+            realloc(forth->tasks, sizeof(forth_task_t) * forth->task_count);
+        memset(&forth->tasks[id], 0,
+               sizeof(forth_task_t) * (forth->task_count - id));
+    }
+
+    forth_task_t *task = &forth->tasks[id];
+    task->data_stack = stack_init(FORTH_TASK_STACK_SIZE);
+    task->control_stack = stack_init(FORTH_TASK_STACK_SIZE);
+
+    // finishing pops this frame, which is what ends the task
+    task->return_stack.size = 16;
+    task->return_stack.frames =
+        malloc(sizeof(forth_frame_t) * task->return_stack.size);
+    task->return_stack.frames[0] = (forth_frame_t) {NULL, NULL};
+    task->return_stack.top = 1;
+
+    task->loop_size = 4;
+    task->loops = calloc(task->loop_size, sizeof(forth_loop_t));
+    task->loop_top = 1;
+
+    task->ip = word->code;
+    task->state = TASK_READY;
+    return id;
+}
+
+// next task to run after the current one, -1 if no other is ready
+static int64_t task_next(forth_t *forth) {
+    for (int64_t n = 1; n < forth->task_count; n++) {
+        int64_t id = (forth->task + n) % forth->task_count;
+        if (forth->tasks[id].state == TASK_READY) {
+            return id;
+        }
+    }
+    return -1;
+}
+
+static const struct forth_instr_s *task_enter(forth_t *forth, int64_t id) {
+    forth_task_t *task = &forth->tasks[id];
+    task_load(forth, task);
+    task->state = TASK_RUNNING;
+    forth->task = id;
+    return task->ip;
+}
+
+// suspends the running task at ip and continues task next
+static const struct forth_instr_s *
+task_switch_to(forth_t *forth, const struct forth_instr_s *ip, int64_t next) {
+    forth_task_t *task = &forth->tasks[forth->task];
+    task_save(forth, task);
+    task->ip = ip;
+    task->state = TASK_READY;
+    return task_enter(forth, next);
+}
+
+// suspends the running task at ip, returns where to continue
+static const struct forth_instr_s *task_switch(forth_t *forth,
+                                               const struct forth_instr_s *ip) {
+    int64_t next = forth->tasks ? task_next(forth) : -1;
+    if (next < 0) {
+        return ip;
+    }
+    return task_switch_to(forth, ip, next);
+}
+
+// the running task returned from its word. slot 0 is suspended whenever
+// another task runs, so there is always one to continue
+static const struct forth_instr_s *task_finish(forth_t *forth) {
+    forth_task_t *task = &forth->tasks[forth->task];
+    task->result = forth->data_stack.top > 0 ? stack_peek(&forth->data_stack)
+                                             : forth_i64(0);
+    task_save(forth, task);
+    task_free_stacks(task);
+    task->state = TASK_DONE;
+    return task_enter(forth, task_next(forth));
+}
+
+// the running task threw and nothing caught it, it ends with the throw code
+// as its result. nobody else would hear of it, so it is reported here
+static const struct forth_instr_s *task_fail(forth_t *forth) {
+    FORTH_ERROR_FUNCTION("Error: task %" PRId64 ": %s\n", forth->task,
+                         forth->error_message);
+    forth->data_stack.top = 0;
+    stack_push(&forth->data_stack, forth_i64(forth->error));
+    forth->error = 0;
+    return task_finish(forth);
+}
+
+// task-join, waits by switching away without moving past ip. nested is set
+// when it runs above the bottom of the return stack and can't switch
+static const struct forth_instr_s *
+task_join(forth_t *forth, const struct forth_instr_s *ip, int nested) {
+    forth_stack_t *data = &forth->data_stack;
+    int64_t id = stack_peek(data).int64;
+
+    if (forth->tasks == NULL || id <= 0 || id >= forth->task_count ||
+        id == forth->task || forth->tasks[id].state == TASK_FREE) {
+        forth_throw(forth, FORTH_THROW_INVALID_ARGUMENT,
+                    "no task %" PRId64 " to join", id);
+    } else if (forth->tasks[id].state == TASK_DONE) {
+        forth->tasks[id].state = TASK_FREE;
+        stack_pop(data);
+        stack_push(data, forth->tasks[id].result);
+        return ip + 1;
+    } else if (!nested) {
+        return task_switch(forth, ip);
+    } else {
+        forth_throw(forth, FORTH_THROW_UNSUPPORTED,
+                    "task-join can't wait here");
+    }
+    return ip + 1;
+}
+
+static int task_pending(forth_t *forth) {
+    for (int64_t n = 1; n < forth->task_count; n++) {
+        if (forth->tasks[n].state == TASK_READY) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -10,7 +10,15 @@ static trie_node_t *trie_create_blank_node(void) {
     trie_node_t *node = (trie_node_t *) malloc(sizeof(trie_node_t));
 
     node->node_type = TRIE_NONE;
+    node->flags = 0;
+    node->version = 0;
+    node->code = NULL;
+    node->code_length = 0;
     node->userword_def = NULL;
+    node->userword_def_len = 0;
+    node->name = NULL;
+    node->in_block = 0;
+    node->xt = 0;
 
     for (size_t i = 0; i < ALPHABET_SIZE; i++) {
         node->children[i] = NULL;
@@ -18,24 +26,29 @@ static trie_node_t *trie_create_blank_node(void) {
     return node;
 }
 
-static void trie_insert_ffi_function(trie_node_t *root, const char *key,
-                                     forth_ffi_fn_ptr ffi_fn) {
-    trie_node_t *current = root;
-
-    for (size_t i = 0; i < strlen(key); i++) {
-        size_t idx = key[i];
-        if (current->children[idx] == NULL) {
-            current->children[idx] = trie_create_blank_node();
+static void trie_free_code(forth_instr_t *code, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (code[i].op == OP_PRINT) {
+            free(code[i].string);
         }
-        current = current->children[idx];
     }
+    free(code);
+}
 
-    current->node_type = TRIE_FFI_FN;
-    current->ffi_fn = ffi_fn;
+// takes the compiled code off a node being redefined, defined in forth.c
+static void forth_retire(forth_t *forth, trie_node_t *node);
+
+// drops whatever the node was defined as, its code is already gone
+static void trie_clear_definition(trie_node_t *node) {
+    free(node->userword_def);
+    node->userword_def = NULL;
+    node->userword_def_len = 0;
+    node->flags = 0;
+    node->version++;
 }
 
-static void trie_insert_builtin(trie_node_t *root, const char *key,
-                                forth_builtin_ptr builtin_fn) {
+// walks to the node for key, creating any missing nodes along the way
+static trie_node_t *trie_insert_key(trie_node_t *root, const char *key) {
     trie_node_t *current = root;
 
     for (size_t i = 0; i < strlen(key); i++) {
@@ -46,51 +59,78 @@ static void trie_insert_builtin(trie_node_t *root, const char *key,
         current = current->children[idx];
     }
 
-    current->node_type = TRIE_BUILTIN;
-    current->builtin_fn = builtin_fn;
+    if (current->name == NULL) {
+        current->name = strdup(key);
+    }
+    return current;
 }
 
-static void trie_insert_userword(trie_node_t *root, const char *key,
-                                 const char *def) {
-    trie_node_t *current = root;
+// the node for key, ready to take a new definition
+static trie_node_t *trie_redefine(forth_t *forth, const char *key) {
+    trie_node_t *current = trie_insert_key(forth->root, key);
+    forth_retire(forth, current);
+    trie_clear_definition(current);
+    return current;
+}
 
-    for (size_t i = 0; i < strlen(key); i++) {
-        size_t idx = key[i];
-        if (current->children[idx] == NULL) {
-            current->children[idx] = trie_create_blank_node();
-        }
-        current = current->children[idx];
-    }
+static void trie_insert_ffi_function(forth_t *forth, const char *key,
+                                     forth_ffi_fn_ptr ffi_fn) {
+    trie_node_t *current = trie_redefine(forth, key);
 
-    current->node_type = TRIE_USERWORD;
-    size_t len = strlen(def);
-    current->userword_def_len = len;
-    current->userword_def = (char *) malloc(len);
-    strncpy(current->userword_def, def, len);
-    current->userword_def[len - 1] = '\0';
+    current->node_type = TRIE_FFI_FN;
+    current->ffi_fn = ffi_fn;
 }
 
-static void trie_insert_variable(trie_node_t *root, const char *key,
-                                 forth_type_t val) {
-    trie_node_t *current = root;
+static trie_node_t *trie_insert_builtin(forth_t *forth, const char *key,
+                                        forth_builtin_ptr builtin_fn) {
+    trie_node_t *current = trie_redefine(forth, key);
 
-    for (size_t i = 0; i < strlen(key); i++) {
-        size_t idx = key[i];
-        if (current->children[idx] == NULL) {
-            current->children[idx] = trie_create_blank_node();
-        }
-        current = current->children[idx];
+    current->node_type = TRIE_BUILTIN;
+    current->builtin_fn = builtin_fn;
+    return current;
+}
+
+// the node takes ownership of code, def is the source text and may be NULL
+static void trie_insert_userword(forth_t *forth, const char *key,
+                                 forth_instr_t *code, size_t code_length,
+                                 const char *def, size_t def_len) {
+    trie_node_t *current = trie_redefine(forth, key);
+
+    current->node_type = TRIE_USERWORD;
+    current->code = code;
+    current->code_length = code_length;
+
+    if (def != NULL) {
+        current->userword_def_len = def_len;
+        current->userword_def = (char *) malloc(def_len + 1);
+        memcpy(current->userword_def, def, def_len);
+        current->userword_def[def_len] = '\0';
     }
+}
+
+static trie_node_t *trie_insert_variable(forth_t *forth, const char *key,
+                                         forth_type_t val) {
+    trie_node_t *current = trie_redefine(forth, key);
 
     current->node_type = TRIE_VARIABLE;
     current->var = val;
+    return current;
+}
+
+static trie_node_t *trie_insert_value(forth_t *forth, const char *key,
+                                      forth_type_t addr) {
+    trie_node_t *current = trie_redefine(forth, key);
+
+    current->node_type = TRIE_VALUE;
+    current->var = addr;
+    return current;
 }
 
 static trie_node_t *trie_search(trie_node_t *root, const char *key) {
     trie_node_t *current = root;
     for (size_t i = 0; i < strlen(key); i++) {
-        size_t idx = key[i];
-        if (current->children[idx] == NULL) {
+        size_t idx = (unsigned char) key[i];
+        if (idx >= ALPHABET_SIZE || current->children[idx] == NULL) {
             return NULL;
         }
         current = current->children[idx];
@@ -113,10 +153,12 @@ static void trie_destroy(trie_node_t *node) {
         }
     }
 
-    if (node->node_type == TRIE_USERWORD && node->userword_def != NULL) {
-        free(node->userword_def);
-        node->userword_def = NULL;
+    if (node->node_type == TRIE_USERWORD) {
+        trie_free_code(node->code, node->code_length);
+    }
+    trie_clear_definition(node);
+    free(node->name);
+    if (!node->in_block) {
+        free(node);
     }
-
-    free(node);
 }
\ No newline at end of file